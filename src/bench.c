@@ -0,0 +1,272 @@
+/* Microbenchmarks do smpl e do rand
+ * Funcionalidade: mede ns/op de schedule/cause, cancel, request/release,
+ * dos geradores de variaveis aleatorias e de cis(), com aquecimento,
+ * repeticoes e dispersao, para comparar antes e depois de uma mudanca.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smpl.h"
+#include "walltime.h"
+#include "cisj.c"
+
+// event numbers used by the kernels
+#define HOLD 1
+#define VICTIM 2
+
+// offsets drawn ahead of time so the kernels don't time the generator
+#define OFFSETS 4096
+
+static double offsets[OFFSETS];
+// results fold into it so no kernel is optimized away
+static volatile double sink;
+
+typedef struct {
+    char name[48];
+    void (*setup)(int arg);
+    void (*run)(int arg, long ops);
+    int arg;
+    long ops; // per repetition
+} Bench;
+
+/*
+ * fill_offsets draws uniform [0, 2*mean) offsets with a private LCG,
+ * leaving smpl's streams alone.
+ */
+static void fill_offsets(double mean) {
+    unsigned long x = 12345;
+    for (int i=0; i<OFFSETS; i++) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+        offsets[i] = 2.0 * mean * (double) (x >> 11) / 9007199254740992.0;
+    }
+}
+
+/*
+ * Event list of `depth` pending events: each op causes the earliest and
+ * schedules it again at a random offset, so insertions scan about half
+ * the list.
+ */
+static void setup_list(int depth) {
+    smpl(0, "bench");
+    fill_offsets(depth);
+    for (int i=0; i<depth; i++)
+        schedule(HOLD, offsets[i % OFFSETS], i);
+}
+
+static void run_schedule_cause(int depth, long ops) {
+    int ev, tkn;
+    for (long i=0; i<ops; i++) {
+        cause(&ev, &tkn);
+        schedule(ev, offsets[i & (OFFSETS-1)], tkn);
+    }
+}
+
+// schedule an event at a random position of the list and cancel it again
+static void run_cancel(int depth, long ops) {
+    for (long i=0; i<ops; i++) {
+        schedule(VICTIM, offsets[i & (OFFSETS-1)], 0);
+        if (cancel(VICTIM) < 0)
+            sink = -1;
+    }
+}
+
+/*
+ * Rounds of `n` events due at the same time, each scheduled again one
+ * unit later once caused, as vcube's test rounds: one event at a time
+ * or the whole round with cause_batch.
+ */
+static int *round_events, *round_tokens;
+
+static void setup_round(int n) {
+    smpl(0, "bench");
+    free(round_events);
+    free(round_tokens);
+    round_events = (int*) malloc(sizeof(int)*n);
+    round_tokens = (int*) malloc(sizeof(int)*n);
+    for (int i=0; i<n; i++)
+        schedule(HOLD, 0.0, i);
+}
+
+static void run_round_cause(int n, long ops) {
+    int ev, tkn;
+    for (long i=0; i<ops; i++) {
+        cause(&ev, &tkn);
+        schedule(ev, 1.0, tkn);
+    }
+}
+
+static void run_round_batch(int n, long ops) {
+    for (long i=0; i<ops; ) {
+        int count = cause_batch(round_events, round_tokens, n);
+        for (int k=0; k<count; k++)
+            schedule(round_events[k], 1.0, round_tokens[k]);
+        i += count;
+    }
+}
+
+/*
+ * A facility with `servers` servers and as many tokens again waiting in
+ * its queue. Each op releases the longest holder, causes the waiter the
+ * release woke up, grants it the server and queues the old holder again.
+ */
+static int bench_facility;
+static int *holders;
+static int holder_head, holder_count;
+
+static void setup_facility(int servers) {
+    smpl(0, "bench");
+    bench_facility = facility("bench", servers);
+    free(holders);
+    holders = (int*) malloc(sizeof(int)*servers);
+    holder_head = holder_count = 0;
+    for (int tkn=0; tkn<2*servers; tkn++) {
+        if (request(bench_facility, tkn, 0) == 0)
+            holders[holder_count++] = tkn;
+    }
+}
+
+static void run_request_release(int servers, long ops) {
+    int ev, tkn;
+    for (long i=0; i<ops; i++) {
+        int holder = holders[holder_head];
+        release(bench_facility, holder);
+        cause(&ev, &tkn);
+        if (request(bench_facility, tkn, 0) != 0)
+            sink = -1;
+        holders[holder_head] = tkn;
+        holder_head = (holder_head + 1) % servers;
+        request(bench_facility, holder, 0);
+    }
+}
+
+static void setup_rand(int arg) {
+    stream(1);
+}
+
+static void run_ranf(int arg, long ops) {
+    double sum = 0;
+    for (long i=0; i<ops; i++)
+        sum += ranf();
+    sink = sum;
+}
+
+static void run_expntl(int arg, long ops) {
+    double sum = 0;
+    for (long i=0; i<ops; i++)
+        sum += expntl(1.0);
+    sink = sum;
+}
+
+static void run_normal(int arg, long ops) {
+    double sum = 0;
+    for (long i=0; i<ops; i++)
+        sum += normal(0.0, 1.0);
+    sink = sum;
+}
+
+static void run_erlang(int arg, long ops) {
+    double sum = 0;
+    for (long i=0; i<ops; i++)
+        sum += erlang(2.0, 1.0);
+    sink = sum;
+}
+
+static void setup_none(int arg) {
+}
+
+// cis(i, s) over every i of a 2^s system, freeing each set
+static void run_cis(int s, long ops) {
+    int mask = (1 << s) - 1;
+    long sum = 0;
+    for (long i=0; i<ops; i++) {
+        node_set *nodes = cis((int) i & mask, s);
+        sum += nodes->nodes[0];
+        set_free(nodes);
+    }
+    sink = sum;
+}
+
+/*
+ * measure runs a warm-up repetition and `reps` timed ones, reporting the
+ * mean ns/op, its relative standard deviation and the best repetition.
+ */
+static void measure(const Bench *b, int reps) {
+    double ns[reps];
+    b->setup(b->arg);
+    b->run(b->arg, b->ops);
+
+    double sum = 0, best = -1;
+    for (int r=0; r<reps; r++) {
+        double start = wall_seconds();
+        b->run(b->arg, b->ops);
+        ns[r] = (wall_seconds() - start) * 1e9 / b->ops;
+        sum += ns[r];
+        if (best < 0 || ns[r] < best)
+            best = ns[r];
+    }
+    double mean = sum / reps, var = 0;
+    for (int r=0; r<reps; r++)
+        var += (ns[r] - mean) * (ns[r] - mean);
+    var = reps > 1 ? var / (reps - 1) : 0;
+    printf("%-32s %10.1f ns/op  +-%5.1f%%  best %10.1f  (%d x %ld ops)\n",
+           b->name, mean, mean > 0 ? 100.0 * sqrt(var) / mean : 0.0, best, reps, b->ops);
+}
+
+int main(int argc, char *argv[]) {
+    int reps = argc > 1 ? atoi(argv[1]) : 10;
+    const char *filter = argc > 2 ? argv[2] : NULL;
+    if (reps < 1) {
+        puts("Usage: [repetitions=10] [name filter]");
+        exit(1);
+    }
+
+    Bench benches[64];
+    int n = 0;
+    int depths[] = {1, 16, 256, 4096, 16384};
+    for (int i=0; i < (int) (sizeof(depths)/sizeof(depths[0])); i++) {
+        Bench b = {"", setup_list, run_schedule_cause, depths[i], 2000000 / (1 + depths[i] / 64)};
+        snprintf(b.name, sizeof(b.name), "schedule+cause depth %d", depths[i]);
+        benches[n++] = b;
+    }
+    for (int i=0; i < 4; i++) {
+        Bench b = {"", setup_list, run_cancel, depths[i], 2000000 / (1 + depths[i] / 64)};
+        snprintf(b.name, sizeof(b.name), "schedule+cancel depth %d", depths[i]);
+        benches[n++] = b;
+    }
+    int rounds[] = {16, 256, 4096};
+    for (int i=0; i < (int) (sizeof(rounds)/sizeof(rounds[0])); i++) {
+        Bench b = {"", setup_round, run_round_cause, rounds[i], 32L * rounds[i]};
+        snprintf(b.name, sizeof(b.name), "cause round of %d", rounds[i]);
+        benches[n++] = b;
+        Bench batch = {"", setup_round, run_round_batch, rounds[i], 32L * rounds[i]};
+        snprintf(batch.name, sizeof(batch.name), "cause_batch round of %d", rounds[i]);
+        benches[n++] = batch;
+    }
+    int servers[] = {1, 8, 256, 4096};
+    for (int i=0; i < (int) (sizeof(servers)/sizeof(servers[0])); i++) {
+        Bench b = {"", setup_facility, run_request_release, servers[i], 500000};
+        snprintf(b.name, sizeof(b.name), "request/release %d servers", servers[i]);
+        benches[n++] = b;
+    }
+    Bench draws[] = {
+        {"ranf", setup_rand, run_ranf, 0, 10000000},
+        {"expntl", setup_rand, run_expntl, 0, 5000000},
+        {"normal", setup_rand, run_normal, 0, 5000000},
+        {"erlang", setup_rand, run_erlang, 0, 5000000},
+    };
+    for (int i=0; i < 4; i++)
+        benches[n++] = draws[i];
+    for (int s=1; s <= 10; s++) {
+        Bench b = {"", setup_none, run_cis, s, 4000000 >> s};
+        snprintf(b.name, sizeof(b.name), "cis dimension %d", s);
+        benches[n++] = b;
+    }
+
+    for (int i=0; i<n; i++) {
+        if (filter == NULL || strstr(benches[i].name, filter) != NULL)
+            measure(&benches[i], reps);
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+/* Ramificacoes do simulador Vcube
+ * Funcionalidade: le o arquivo de variantes, bifurca um filho por
+ * variante e recolhe os resultados de cada um.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "branch.h"
+#include "util.h"
+
+// write end of the pipe to the parent, in a child
+static int report_fd = -1;
+
+static Variant *variant_named(Variant **variants, int *count, int *cap, const char *name) {
+    for (int i=0; i<*count; i++) {
+        if (strcmp((*variants)[i].name, name) == 0)
+            return &(*variants)[i];
+    }
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        Variant *grown = (Variant*) realloc(*variants, sizeof(Variant)*(*cap));
+        if (grown == NULL)
+            return NULL;
+        *variants = grown;
+    }
+    Variant *v = &(*variants)[(*count)++];
+    memset(v, 0, sizeof(Variant));
+    strcpy(v->name, name);
+    return v;
+}
+
+Variant *variants_read(const char *path, int *count, char *error, size_t error_size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        snprintf(error, error_size, "could not be read");
+        return NULL;
+    }
+
+    Variant *variants = NULL;
+    int cap = 0;
+    long line_no = 0;
+    char buf[256];
+    const char *what = NULL;
+    *count = 0;
+    while (what == NULL && fgets(buf, sizeof(buf), file)) {
+        line_no++;
+        char *line = trim(buf);
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        // variant,time,process,event
+        char *fields[4] = {line, NULL, NULL, NULL};
+        int nfields = 1;
+        for (char *c = line; *c && nfields < 4; c++) {
+            if (*c == ',') {
+                *c = '\0';
+                fields[nfields++] = c + 1;
+            }
+        }
+        if (nfields != 4) {
+            what = "expected variant,time,process,event";
+            break;
+        }
+        for (int i=0; i<4; i++)
+            fields[i] = trim(fields[i]);
+
+        FaultRecord rec;
+        char *end;
+        rec.time = strtod(fields[1], &end);
+        if (end == fields[1] || *end != '\0' || rec.time < 0) {
+            // lines ahead of the first record may be a header
+            if (*count == 0)
+                continue;
+            what = "bad time";
+            break;
+        }
+        rec.process = (int) strtol(fields[2], &end, 10);
+        if (end == fields[2] || *end != '\0' || rec.process < 0) {
+            what = "bad process";
+            break;
+        }
+        rec.kind = faultlog_kind(fields[3]);
+        if (rec.kind < 0) {
+            what = "unknown event";
+            break;
+        }
+        if (*fields[0] == '\0' || strlen(fields[0]) >= VARIANT_NAME) {
+            what = "bad variant name";
+            break;
+        }
+
+        Variant *v = variant_named(&variants, count, &cap, fields[0]);
+        if (v != NULL && v->count == v->cap) {
+            v->cap = v->cap ? v->cap * 2 : 8;
+            FaultRecord *grown = (FaultRecord*) realloc(v->records, sizeof(FaultRecord)*v->cap);
+            if (grown == NULL)
+                v = NULL;
+            else
+                v->records = grown;
+        }
+        if (v == NULL) {
+            what = "out of memory";
+            break;
+        }
+        v->records[v->count++] = rec;
+    }
+    fclose(file);
+
+    if (what == NULL && *count == 0)
+        what = "no variants";
+    if (what) {
+        snprintf(error, error_size, "line %ld: %s", line_no, what);
+        variants_free(variants, *count);
+        return NULL;
+    }
+    return variants;
+}
+
+void variants_free(Variant *variants, int count) {
+    for (int i=0; i<count; i++)
+        free(variants[i].records);
+    free(variants);
+}
+
+int branch_fork(int count, int jobs, size_t size, void *results) {
+    if (jobs < 1)
+        jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1)
+        jobs = 1;
+
+    pid_t *pids = (pid_t*) calloc(count, sizeof(pid_t));
+    int *fds = (int*) malloc(sizeof(int)*count);
+    char *result = (char*) malloc(size);
+    if (pids == NULL || fds == NULL || result == NULL) {
+        fprintf(stderr, "could not branch\n");
+        exit(1);
+    }
+
+    int next = 0, running = 0;
+    while (next < count || running > 0) {
+        if (next < count && running < jobs) {
+            int i = next++;
+            int fd[2];
+            if (pipe(fd) != 0) {
+                fprintf(stderr, "could not branch variant %d\n", i);
+                continue;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                // the other children's pipes are none of this one's business
+                close(fd[0]);
+                for (int j=0; j<i; j++) {
+                    if (pids[j] > 0)
+                        close(fds[j]);
+                }
+                free(pids);
+                free(fds);
+                free(result);
+                report_fd = fd[1];
+                return i;
+            }
+            close(fd[1]);
+            if (pid < 0) {
+                fprintf(stderr, "could not branch variant %d\n", i);
+                close(fd[0]);
+                continue;
+            }
+            pids[i] = pid;
+            fds[i] = fd[0];
+            running++;
+            continue;
+        }
+
+        // results are smaller than a pipe's buffer: read them once the child is gone
+        pid_t pid = waitpid(-1, NULL, 0);
+        if (pid < 0 && errno == EINTR)
+            continue;
+        if (pid < 0)
+            break;
+        for (int j=0; j<count; j++) {
+            if (pids[j] != pid)
+                continue;
+            if (read_all(fds[j], result, size) == 0)
+                memcpy((char*) results + (size_t) j * size, result, size);
+            close(fds[j]);
+            pids[j] = 0;
+            running--;
+        }
+    }
+    free(pids);
+    free(fds);
+    free(result);
+    return -1;
+}
+
+void branch_report(const void *result, size_t size) {
+    int failed = write_all(report_fd, result, size) != 0;
+    close(report_fd);
+    _exit(failed);
+}
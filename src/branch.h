@@ -0,0 +1,54 @@
+/* Ramificacoes do simulador Vcube
+ * Funcionalidade: simula um prefixo comum uma vez e bifurca o processo
+ * com fork(), cada filho aplicando seu proprio cenario de falhas a partir
+ * dali e devolvendo seus resultados ao pai por um pipe.
+ */
+
+#ifndef BRANCH_H
+#define BRANCH_H
+
+#include <stddef.h>
+
+#include "faultlog.h"
+
+#define VARIANT_NAME 32
+
+/*
+ * Variant is one what-if continuation: faults and recoveries injected
+ * `time` units past the branch point.
+ */
+typedef struct {
+    char name[VARIANT_NAME];
+    FaultRecord *records;
+    int count;
+    int cap;
+} Variant;
+
+/*
+ * variants_read reads the variants file at path: one
+ * `variant,time,process,event` line per record, event named as in
+ * failure logs (see faultlog.h). Records of a variant needn't be
+ * contiguous nor in time order; variants come in order of first
+ * appearance. Blank lines, lines starting with # and lines ahead of the
+ * first record not starting with a time, such as a header, are skipped.
+ * Return them and their number in *count, or NULL with the reason in
+ * error.
+ */
+Variant *variants_read(const char *path, int *count, char *error, size_t error_size);
+
+void variants_free(Variant *variants, int count);
+
+/*
+ * branch_fork forks a child per variant, running `jobs` of them at most
+ * at once, all online CPUs when jobs < 1. A child returns at once with
+ * its variant's index and must end in branch_report. The parent returns
+ * -1 once every child ended, result i being in results + i * size, or
+ * left untouched if child i died without reporting. Flush stdio before
+ * calling it.
+ */
+int branch_fork(int count, int jobs, size_t size, void *results);
+
+// send the child's result to the parent and end the child
+void branch_report(const void *result, size_t size);
+
+#endif
@@ -0,0 +1,137 @@
+/* Comparativo de corrotinas do smpl
+ * Funcionalidade: roda o mesmo modelo de fila fechada escrito com rotinas
+ * de evento e com corrotinas (smplco) e compara o custo por evento.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "smpl.h"
+#include "smplco.h"
+#include "walltime.h"
+
+#define REQUEST 1
+#define RELEASE 2
+#define COROUTINE 3
+
+// customers cycle through the facility for these, by token
+#define SERVICE(tkn) (1.0 + ((tkn) % 4) * 0.25)
+// and first arrive within the first unit of time, last spawned first
+#define ARRIVAL(i, n) ((double) ((n) - (i)) / (n))
+
+static int server;
+
+/*
+ * Both runs hash the (time, token) of every event caused, FNV-1a, to
+ * tell whether they went through the same sequence. Event codes are left
+ * out as the coroutine run causes COROUTINE events only.
+ */
+static uint64_t sequence;
+
+static void hash_event(double t, int tkn) {
+    unsigned char bytes[sizeof(t) + sizeof(tkn)];
+    memcpy(bytes, &t, sizeof(t));
+    memcpy(bytes + sizeof(t), &tkn, sizeof(tkn));
+    for (size_t i=0; i<sizeof(bytes); i++)
+        sequence = (sequence ^ bytes[i]) * 1099511628211ULL;
+}
+
+/*
+ * run_events is the closed queue as event routines: each customer
+ * requests the facility, holds it for its service time, releases it
+ * and requests it again right after anyone it woke up.
+ * Return the number of events caused before `until`.
+ */
+static long run_events(int customers, double until) {
+    int ev, tkn;
+    long events = 0;
+    // arrivals in decreasing time order go to the head of the event list
+    for (int i=0; i<customers; i++)
+        schedule(REQUEST, ARRIVAL(i, customers), i);
+
+    while (time() < until) {
+        cause(&ev, &tkn);
+        events++;
+        hash_event(time(), tkn);
+        switch (ev) {
+            case REQUEST:
+                // a queued request comes back as this event once released
+                if (request(server, tkn, 0) == 0)
+                    schedule(RELEASE, SERVICE(tkn), tkn);
+                break;
+            case RELEASE:
+                release(server, tkn);
+                schedule(REQUEST, 0.0, tkn);
+                break;
+        }
+    }
+    return events;
+}
+
+/*
+ * customer is the same customer written as a coroutine.
+ */
+static void customer(void *arg) {
+    (void) arg;
+    for (;;) {
+        co_request(server, 0);
+        co_hold(SERVICE(co_self()));
+        co_release(server);
+        co_hold(0.0);
+    }
+}
+
+static long run_coroutines(int customers, double until) {
+    int ev, tkn;
+    long events = 0;
+    for (int i=0; i<customers; i++)
+        co_spawn(customer, NULL, ARRIVAL(i, customers));
+
+    while (time() < until) {
+        cause(&ev, &tkn);
+        events++;
+        hash_event(time(), tkn);
+        co_dispatch(ev, tkn);
+    }
+    return events;
+}
+
+int main(int argc, char *argv[]) {
+    int customers = argc > 1 ? atoi(argv[1]) : 100000;
+    int servers = argc > 2 ? atoi(argv[2]) : 1;
+    double until = argc > 3 ? atof(argv[3]) : 100000.0;
+    size_t stack = argc > 4 ? (size_t) atol(argv[4]) : 4096;
+    if (customers < 1 || servers < 1) {
+        puts("Usage: [customers=100000] [servers=1] [until=100000] [stack bytes=4096]");
+        exit(1);
+    }
+
+    smpl(0, "events");
+    server = facility("server", servers);
+    sequence = 14695981039346656037ULL;
+    double start = wall_seconds();
+    long events = run_events(customers, until);
+    double elapsed = wall_seconds() - start;
+    uint64_t event_sequence = sequence;
+    printf("event routines: %ld events, %.1f ns/event\n", events, elapsed * 1e9 / events);
+
+    smpl(0, "coroutines");
+    server = facility("server", servers);
+    if (co_init(COROUTINE, customers, stack) != 0) {
+        puts("could not set coroutines up");
+        exit(1);
+    }
+    sequence = 14695981039346656037ULL;
+    start = wall_seconds();
+    long co_events = run_coroutines(customers, until);
+    elapsed = wall_seconds() - start;
+    printf("coroutines:     %ld events, %.1f ns/event (%d coroutines, %zu byte stacks)\n",
+           co_events, elapsed * 1e9 / co_events, customers, stack);
+
+    int same = co_events == events && sequence == event_sequence;
+    printf("%s\n", same ? "same event sequence" : "EVENT SEQUENCES DIFFER");
+    co_end();
+    return same ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/* Logs de falhas do simulador Vcube
+ * Funcionalidade: mapeia o log, interpreta CSV ou binario e devolve ao
+ * kernel as paginas ja lidas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "faultlog.h"
+#include "util.h"
+
+// read bytes handed back to the kernel at a time
+#define RELEASE_CHUNK (16UL << 20)
+
+FaultLog *faultlog_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    FaultLog *log = (FaultLog*) calloc(1, sizeof(FaultLog));
+    if (log == NULL) {
+        close(fd);
+        return NULL;
+    }
+    log->size = (size_t) st.st_size;
+    if (log->size > 0) {
+        void *map = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            free(log);
+            return NULL;
+        }
+        madvise(map, log->size, MADV_SEQUENTIAL);
+        log->map = (const char*) map;
+    }
+    close(fd);
+
+    if (log->size >= 8 && memcmp(log->map, FAULTLOG_MAGIC, 8) == 0) {
+        log->binary = 1;
+        log->pos = 8;
+    }
+    return log;
+}
+
+/*
+ * release drops the whole pages before pos once a chunk of them piled up.
+ */
+static void release(FaultLog *log) {
+    if (log->pos - log->released < RELEASE_CHUNK)
+        return;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t upto = log->pos / page * page;
+    madvise((void*) (log->map + log->released), upto - log->released, MADV_DONTNEED);
+    log->released = upto;
+}
+
+int faultlog_kind(const char *name) {
+    if (strcmp(name, "fault") == 0 || strcmp(name, "crash") == 0 || strcmp(name, "down") == 0)
+        return FAULTLOG_FAULT;
+    if (strcmp(name, "recovery") == 0 || strcmp(name, "recover") == 0 || strcmp(name, "up") == 0)
+        return FAULTLOG_RECOVERY;
+    return -1;
+}
+
+static int fail(FaultLog *log, const char *what) {
+    if (log->binary)
+        snprintf(log->error, sizeof(log->error), "record %ld: %s", log->records + 1, what);
+    else
+        snprintf(log->error, sizeof(log->error), "line %ld: %s", log->line, what);
+    return FAULTLOG_ERROR;
+}
+
+static int read_binary(FaultLog *log, FaultRecord *rec) {
+    if (log->pos == log->size)
+        return FAULTLOG_END;
+    if (log->size - log->pos < sizeof(FaultRecord))
+        return fail(log, "truncated record");
+    memcpy(rec, log->map + log->pos, sizeof(FaultRecord));
+    log->pos += sizeof(FaultRecord);
+    if (rec->kind != FAULTLOG_FAULT && rec->kind != FAULTLOG_RECOVERY)
+        return fail(log, "unknown event");
+    return FAULTLOG_RECORD;
+}
+
+static int read_csv(FaultLog *log, FaultRecord *rec) {
+    while (log->pos < log->size) {
+        const char *p = log->map + log->pos;
+        const char *nl = (const char*) memchr(p, '\n', log->size - log->pos);
+        size_t len = nl ? (size_t) (nl - p) : log->size - log->pos;
+        log->pos += len + (nl != NULL);
+        log->line++;
+
+        char buf[128];
+        if (len >= sizeof(buf))
+            return fail(log, "line too long");
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+        char *line = trim(buf);
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        // time,process,event
+        char *fields[3] = {line, NULL, NULL};
+        int count = 1;
+        for (char *c = line; *c && count < 3; c++) {
+            if (*c == ',') {
+                *c = '\0';
+                fields[count++] = c + 1;
+            }
+        }
+
+        for (int i=0; i<count; i++)
+            fields[i] = trim(fields[i]);
+        char *end;
+        rec->time = strtod(fields[0], &end);
+        if (end == fields[0] || *end != '\0') {
+            // lines ahead of the first record may be a header
+            if (log->records == 0)
+                continue;
+            return fail(log, "bad time");
+        }
+        if (count != 3)
+            return fail(log, "expected time,process,event");
+        rec->process = (int32_t) strtol(fields[1], &end, 10);
+        if (end == fields[1] || *end != '\0' || rec->process < 0)
+            return fail(log, "bad process");
+        rec->kind = faultlog_kind(fields[2]);
+        if (rec->kind < 0)
+            return fail(log, "unknown event");
+        return FAULTLOG_RECORD;
+    }
+    return FAULTLOG_END;
+}
+
+int faultlog_next(FaultLog *log, FaultRecord *rec) {
+    int result = log->binary ? read_binary(log, rec) : read_csv(log, rec);
+    if (result != FAULTLOG_RECORD)
+        return result;
+    release(log);
+
+    if (log->records == 0)
+        log->origin = rec->time;
+    rec->time -= log->origin;
+    if (log->records > 0 && rec->time < log->last)
+        return fail(log, "records out of time order");
+    log->last = rec->time;
+    log->records++;
+    return FAULTLOG_RECORD;
+}
+
+void faultlog_close(FaultLog *log) {
+    if (log->map)
+        munmap((void*) log->map, log->size);
+    free(log);
+}
@@ -0,0 +1,66 @@
+/* Logs de falhas do simulador Vcube
+ * Funcionalidade: le um historico de falhas e recuperacoes, em CSV ou
+ * binario, mapeado em memoria e consumido em ordem, para alimentar a
+ * simulacao aos poucos.
+ */
+
+#ifndef FAULTLOG_H
+#define FAULTLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FaultRecord.kind
+#define FAULTLOG_FAULT 0
+#define FAULTLOG_RECOVERY 1
+
+// faultlog_next results
+#define FAULTLOG_END 0
+#define FAULTLOG_RECORD 1
+#define FAULTLOG_ERROR -1
+
+/*
+ * Binary logs start with these 8 bytes, followed by FaultRecords in host
+ * byte order. Anything else is read as CSV: one `time,process,event` line
+ * per record, event being fault, crash or down, or recovery, recover or
+ * up. Blank lines, lines starting with # and lines ahead of the first
+ * record not starting with a time, such as a header, are skipped.
+ * Either way records must come in time order.
+ */
+#define FAULTLOG_MAGIC "VCFLOG1"
+
+typedef struct {
+    double time; // relative to the log's first record
+    int32_t process;
+    int32_t kind; // FAULTLOG_*
+} FaultRecord;
+
+typedef struct {
+    const char *map;
+    size_t size;
+    size_t pos; // next byte to read
+    size_t released; // bytes before it already dropped from memory
+    int binary;
+    long line; // CSV line last read
+    long records; // records returned
+    double origin; // time of the first record
+    double last; // time of the last record returned
+    char error[128]; // what a FAULTLOG_ERROR was about
+} FaultLog;
+
+// map the log at path, return NULL if it can't be read
+FaultLog *faultlog_open(const char *path);
+
+/*
+ * faultlog_next reads the next record into rec. Pages read past are
+ * handed back to the kernel as it goes, so memory use doesn't grow with
+ * the log. Return FAULTLOG_RECORD, FAULTLOG_END or FAULTLOG_ERROR.
+ */
+int faultlog_next(FaultLog *log, FaultRecord *rec);
+
+void faultlog_close(FaultLog *log);
+
+// FAULTLOG_FAULT or FAULTLOG_RECOVERY for an event name, -1 if unknown
+int faultlog_kind(const char *name);
+
+#endif
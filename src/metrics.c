@@ -0,0 +1,73 @@
+/* Metricas ao vivo do simulador Vcube
+ * Funcionalidade: cria e mapeia a regiao compartilhada e implementa as
+ * duas pontas do seqlock.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+
+MetricsRegion *metrics_create(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, sizeof(MetricsRegion)) != 0) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, sizeof(MetricsRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    MetricsRegion *region = (MetricsRegion*) map;
+    memset(region, 0, sizeof(MetricsRegion));
+    region->pid = getpid();
+    region->version = METRICS_VERSION;
+    // magic goes last: readers attaching meanwhile see no region yet
+    atomic_thread_fence(memory_order_release);
+    region->magic = METRICS_MAGIC;
+    return region;
+}
+
+const MetricsRegion *metrics_attach(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    void *map = mmap(NULL, sizeof(MetricsRegion), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const MetricsRegion *region = (const MetricsRegion*) map;
+    if (region->magic != METRICS_MAGIC || region->version != METRICS_VERSION) {
+        munmap(map, sizeof(MetricsRegion));
+        return NULL;
+    }
+    return region;
+}
+
+void metrics_publish(MetricsRegion *region, const MetricsData *data) {
+    uint32_t seq = atomic_load_explicit(&region->seq, memory_order_relaxed);
+    atomic_store_explicit(&region->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&region->data, data, sizeof(MetricsData));
+    atomic_store_explicit(&region->seq, seq + 2, memory_order_release);
+}
+
+void metrics_read(const MetricsRegion *region, MetricsData *data) {
+    MetricsRegion *shared = (MetricsRegion*) region;
+    for (;;) {
+        uint32_t before = atomic_load_explicit(&shared->seq, memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(data, (const void*) &region->data, sizeof(MetricsData));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shared->seq, memory_order_relaxed) == before)
+            return;
+    }
+}
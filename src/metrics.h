@@ -0,0 +1,82 @@
+/* Metricas ao vivo do simulador Vcube
+ * Funcionalidade: publica o andamento da simulacao numa regiao de memoria
+ * compartilhada, protegida por seqlock, lida por vcube_top sem interferir
+ * no laco de eventos.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define METRICS_MAGIC 0x5643554d  // "MUCV"
+#define METRICS_VERSION 1
+
+// most recent fault/recovery events whose diagnosis is followed
+#define METRICS_EVENTS 8
+
+// MetricsEvent.state
+#define METRICS_PENDING 0    // correct processes don't all know it yet
+#define METRICS_AGREED 1     // they do
+#define METRICS_SUPERSEDED 2 // the process failed or recovered again since
+
+typedef struct {
+    int32_t target; // process that failed or recovered
+    int32_t timestamp; // its timestamp after the event
+    double injected; // simulated time of the event
+    int32_t agree; // correct processes holding the timestamp
+    int32_t needed; // correct processes other than the target
+    int32_t state;
+    int32_t pad;
+} MetricsEvent;
+
+typedef struct {
+    double sim_time;
+    double deadline;
+    double wall_seconds; // since the simulation started
+    double events_per_second; // since the previous publication
+    uint64_t events; // events processed
+    int32_t event_list; // events pending in smpl
+    int32_t pool_used; // smpl elements in use
+    int32_t pool_max;
+    int32_t pool_size;
+    int32_t process_count;
+    int32_t faulty;
+    int32_t disagreeing; // targets correct processes don't agree on
+    int32_t pending; // events waiting for agreement
+    uint64_t agreements; // events that reached agreement
+    double last_latency; // of the last agreement
+    double max_latency;
+    int32_t done; // the simulation has ended
+    int32_t event_count; // valid entries in recent, newest first
+    MetricsEvent recent[METRICS_EVENTS];
+} MetricsData;
+
+/*
+ * MetricsRegion is the shared mapping. seq is odd while the simulator
+ * writes data: readers retry until they copy data between two equal,
+ * even reads of seq. The simulator never waits for readers.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid; // simulator process
+    int32_t pad;
+    _Alignas(64) _Atomic uint32_t seq;
+    _Alignas(64) MetricsData data;
+} MetricsRegion;
+
+// create the region at path, return NULL if it can't be mapped
+MetricsRegion *metrics_create(const char *path);
+
+// map an existing region read-only, return NULL if it isn't one
+const MetricsRegion *metrics_attach(const char *path);
+
+// copy data into the region
+void metrics_publish(MetricsRegion *region, const MetricsData *data);
+
+// take a consistent copy of the region's data
+void metrics_read(const MetricsRegion *region, MetricsData *data);
+
+#endif
@@ -0,0 +1,29 @@
+/* Pontos de instrumentacao estaticos (USDT)
+ * Funcionalidade: expoe tracepoints para perf/bpftrace quando <sys/sdt.h>
+ * esta disponivel; caso contrario as macros nao geram codigo.
+ *
+ * Probes only take integer arguments, e.g.
+ *   bpftrace -e 'usdt:./vcube:vcube:test { @[arg2] = count(); }'
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>) && !defined(NO_PROBES)
+#include <sys/sdt.h>
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#define PROBE1(provider, name, a) DTRACE_PROBE1(provider, name, a)
+#define PROBE2(provider, name, a, b) DTRACE_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c) DTRACE_PROBE3(provider, name, a, b, c)
+#else
+#define PROBE1(provider, name, a) do {} while (0)
+#define PROBE2(provider, name, a, b) do {} while (0)
+#define PROBE3(provider, name, a, b, c) do {} while (0)
+#endif
+
+#endif
@@ -23,6 +23,9 @@ static long In[16]= {0L,   /* seeds for streams 1 thru 15  */
 
 static int strm=1;         /* index of current stream */
 
+extern int recording;      /* smpl is recording an operation trace */
+extern void record_rng(int op, long a, int n, double v);
+
 /*-------------  UNIFORM [0, 1] RANDOM NUMBER GENERATOR  -------------*/
 /*                                                                    */
 /* This implementation is for Intel 8086/8 and 80286/386 CPUs using   */
@@ -43,6 +46,7 @@ real ranf()
     /* form Z + K [- M] (where Z=Lo): presubtract M to avoid overflow */
     Lo-=M; Lo+=k; if (Lo<0) then Lo+=M;
     In[strm]=Lo;
+    if (recording) then record_rng('D',0L,0,(real)Lo*4.656612875E-10);
     return((real)Lo*4.656612875E-10);             /* Lo x 1/(2**31-1) */
   }
 
@@ -72,6 +76,7 @@ stream(n)
           case 15:In[15] = 553303732L; break;
         }
         strm=n;
+        if (recording) then record_rng('T',0L,n,0.0);
       }
       return(strm);
     }
@@ -82,6 +87,7 @@ long seed(Ik,n)
     { /* set seed of stream n for Ik>0, return current seed for Ik=0  */
       if ((n<1)||(n>15)) then error(0,"seed Argument Error");
       if (Ik>0L) then  In[n]=Ik;
+      if (recording && (Ik>0L)) then record_rng('K',Ik,n,0.0);
       return(In[n]);
     }
 
@@ -0,0 +1,272 @@
+/* Replay de traces do smpl
+ * Funcionalidade: reexecuta um trace gravado com record() contra o motor
+ * smpl atual, confere os resultados bit a bit e mede o tempo de execucao.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "smpl.h"
+#include "walltime.h"
+
+/*
+ * Op is a decoded trace record, fields named after record()'s layout.
+ * Results recorded alongside the call are the ones checked on replay.
+ */
+typedef struct {
+    char op;
+    int a, b, c, d; // ints in record order
+    double x; // te, clock, draw or period
+    double y; // advance limit
+    int64_t l; // seed value, operation count or periods advanced
+    char *name; // facility name
+} Op;
+
+typedef struct {
+    const unsigned char *at;
+    const unsigned char *end;
+} Reader;
+
+static int read_bytes(Reader *r, void *dst, size_t n) {
+    if ((size_t) (r->end - r->at) < n)
+        return 0;
+    memcpy(dst, r->at, n);
+    r->at += n;
+    return 1;
+}
+
+static int read_int(Reader *r, int *v) {
+    int32_t i;
+    if (!read_bytes(r, &i, sizeof(i)))
+        return 0;
+    *v = i;
+    return 1;
+}
+
+static void free_ops(Op *ops, long n) {
+    for (long i=0; i<n; i++)
+        free(ops[i].name);
+    free(ops);
+}
+
+/*
+ * load_trace decodes the whole trace up front so that the replay loop
+ * only times the engine. Return the number of operations, -1 on error.
+ */
+static long load_trace(const char *path, Op **ops_out) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("could not open %s\n", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *buf = (unsigned char*) malloc(size > 0 ? size : 1);
+    if (buf == NULL || fread(buf, 1, size, f) != (size_t) size) {
+        printf("could not read %s\n", path);
+        free(buf);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    if (size < 8 || memcmp(buf, "SMPLTRC1", 8) != 0) {
+        printf("%s is not an smpl trace\n", path);
+        free(buf);
+        return -1;
+    }
+
+    Reader r = {buf + 8, buf + size};
+    long cap = 1024, n = 0;
+    Op *ops = (Op*) malloc(sizeof(Op)*cap);
+    int ok = 1;
+    while (ok && r.at < r.end) {
+        Op *grown = ops;
+        if (n == cap) {
+            cap *= 2;
+            grown = (Op*) realloc(ops, sizeof(Op)*cap);
+        }
+        if (grown == NULL) {
+            printf("could not allocate trace\n");
+            free_ops(ops, n);
+            free(buf);
+            return -1;
+        }
+        ops = grown;
+
+        Op *op = &ops[n++];
+        memset(op, 0, sizeof(Op));
+        op->op = *r.at++;
+        switch (op->op) {
+            case 'F':
+                ok = read_int(&r, &op->a) && read_int(&r, &op->b) && read_int(&r, &op->c);
+                if (ok) {
+                    op->name = (char*) calloc(op->c + 1, 1);
+                    ok = op->name != NULL && read_bytes(&r, op->name, op->c);
+                }
+                break;
+            case 'S':
+                ok = read_int(&r, &op->a) && read_bytes(&r, &op->x, 8) && read_int(&r, &op->b);
+                break;
+            case 'C':
+                ok = read_int(&r, &op->a) && read_int(&r, &op->b) && read_bytes(&r, &op->x, 8);
+                break;
+            case 'X':
+            case 'R':
+            case 'U':
+                ok = read_int(&r, &op->a) && read_int(&r, &op->b);
+                break;
+            case 'Q':
+            case 'P':
+                ok = read_int(&r, &op->a) && read_int(&r, &op->b)
+                     && read_int(&r, &op->c) && read_int(&r, &op->d);
+                break;
+            case 'D':
+                ok = read_bytes(&r, &op->x, 8);
+                break;
+            case 'T':
+                ok = read_int(&r, &op->a);
+                break;
+            case 'K':
+                ok = read_bytes(&r, &op->l, 8) && read_int(&r, &op->a);
+                break;
+            case 'A':
+                ok = read_int(&r, &op->a) && read_bytes(&r, &op->x, 8)
+                     && read_bytes(&r, &op->y, 8) && read_bytes(&r, &op->l, 8);
+                break;
+            case 'Z':
+                break;
+            case 'E':
+                ok = read_bytes(&r, &op->l, 8) && read_bytes(&r, &op->x, 8);
+                break;
+            default:
+                printf("unknown trace record '%c' at operation %ld\n", op->op, n);
+                free_ops(ops, n);
+                free(buf);
+                return -1;
+        }
+    }
+    free(buf);
+    if (!ok) {
+        printf("truncated trace at operation %ld\n", n);
+        free_ops(ops, n);
+        return -1;
+    }
+    *ops_out = ops;
+    return n;
+}
+
+static long mismatches;
+
+static void mismatch(long i, const Op *op, const char *what) {
+    if (mismatches++ < 10)
+        printf("operation %ld ('%c'): %s differs\n", i, op->op, what);
+}
+
+/*
+ * replay re-executes ops against the engine, counting mismatches.
+ * Calls return values are kept in locals so nothing is optimized away.
+ */
+static void replay(Op *ops, long n) {
+    int ev, tkn;
+    for (long i=0; i<n; i++) {
+        Op *op = &ops[i];
+        switch (op->op) {
+            case 'F':
+                if (facility(op->name, op->a) != op->b)
+                    mismatch(i, op, "facility id");
+                break;
+            case 'S':
+                schedule(op->a, op->x, op->b);
+                break;
+            case 'C': {
+                cause(&ev, &tkn);
+                double now = time();
+                if (ev != op->a || tkn != op->b || memcmp(&now, &op->x, 8) != 0)
+                    mismatch(i, op, "caused event");
+                break;
+            }
+            case 'X':
+                if (cancel(op->a) != op->b)
+                    mismatch(i, op, "cancelled token");
+                break;
+            case 'U':
+                uncause(op->a, op->b);
+                break;
+            case 'Q':
+                if (request(op->a, op->b, op->c) != op->d)
+                    mismatch(i, op, "request result");
+                break;
+            case 'P':
+                if (preempt(op->a, op->b, op->c) != op->d)
+                    mismatch(i, op, "preempt result");
+                break;
+            case 'R':
+                release(op->a, op->b);
+                break;
+            case 'D': {
+                double v = ranf();
+                if (memcmp(&v, &op->x, 8) != 0)
+                    mismatch(i, op, "random draw");
+                break;
+            }
+            case 'T':
+                stream(op->a);
+                break;
+            case 'K':
+                seed((long) op->l, op->a);
+                break;
+            case 'A':
+                if (advance(op->a, op->x, op->y) != op->l)
+                    mismatch(i, op, "periods advanced");
+                break;
+            case 'Z':
+                reset();
+                break;
+            case 'E': {
+                double now = time();
+                if (op->l != i || memcmp(&now, &op->x, 8) != 0)
+                    mismatch(i, op, "final clock");
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        puts("Usage: [trace file] [repetitions=1]");
+        exit(1);
+    }
+    int reps = argc > 2 ? atoi(argv[2]) : 1;
+    if (reps < 1)
+        reps = 1;
+
+    Op *ops;
+    long n = load_trace(argv[1], &ops);
+    if (n < 0)
+        exit(1);
+
+    double best = -1, total = 0;
+    for (int rep=0; rep<reps; rep++) {
+        smpl(0, "replay");
+        mismatches = 0;
+        double start = wall_seconds();
+        replay(ops, n);
+        double elapsed = wall_seconds() - start;
+        total += elapsed;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+        if (mismatches)
+            break;
+    }
+
+    printf("%ld operations, best %.3f ms (%.1f ns/op), mean %.3f ms over %d runs: %s\n",
+           n, best * 1e3, n ? best * 1e9 / n : 0.0, total * 1e3 / reps, reps,
+           mismatches ? "MISMATCH" : "OK");
+    free_ops(ops, n);
+    return mismatches ? 1 : 0;
+}
@@ -9,13 +9,23 @@
 /**********************************************************************/
 
 #include "smpl.h"
+#include "probes.h"
 
-#define nl 30000     /* element pool length - 30000         */
+#ifndef SMPL_POOL     /* override with -DSMPL_POOL=n to host */
+#define SMPL_POOL 30000 /* models with tens of thousands of    */
+#endif                /* concurrently scheduled events       */
+#define nl SMPL_POOL /* element pool length - SMPL_POOL     */
 #define ns 27680     /* name space length - 27680           */
 #define pl 58        /* printer page length   (lines used   */
 #define sl 23        /* screen page length     by 'smpl'    */
 #define FF 12        /* form feed                           */
 
+/* index of the statistics element that trails facility f's servers:  */
+/* l3 holds the total release count & l4 the total busy time of them, */
+/* l1 the number (+1) of a multi-server facility's server index       */
+#define fst(f) ((f)+l1[f]+2)
+#define fsv(f) (l1[fst(f)]? fsx[l1[fst(f)]-1]:NULL)
+
 static FILE
     *display, *opf;
 /* A inicializacao das duas variaveis acima, feita quando da 
@@ -35,7 +45,85 @@ static int
   avn,               /* next available namespace position   */
   tr,                /* event trace flag                    */
   mr,                /* monitor activation flag             */
-  lft=sl;            /* lines left on current page/screen   */
+  lft=sl,            /* lines left on current page/screen   */
+  evn,               /* current event list length           */
+  evx,               /* maximum event list length           */
+  nel;               /* elements currently in use           */
+
+static long
+  nsch,              /* events scheduled                    */
+  ncau;              /* events caused                       */
+
+static struct smpl_counts
+  cnt;               /* hot-path counters                   */
+
+static FILE
+  *rec;              /* operation trace being recorded      */
+
+static void rec_op(char op);
+static void rec_int(int v);
+static void rec_real(real v);
+
+/* server index of a multi-server facility:  lets request, preempt &  */
+/* release find a server in O(1)/O(log n) rather than scanning them,  */
+/* while picking the very server the scans would (lowest-numbered     */
+/* free server, lowest-numbered one owned by a token, lowest-number-  */
+/* ed among the lowest-priority users), so per-server statistics stay */
+/* exact.  Server numbers below are element indices.                  */
+struct fsrv
+  {
+    int f,n;           /* facility & number of servers        */
+    uint64_t *fre;     /* bit s set while server f+2+s is free */
+    uint64_t *sum;     /* bit w set while fre[w] is nonzero   */
+    int *hp;           /* busy servers, heap on (pri, number) */
+    int *pos;          /* heap position per server, -1 free   */
+    int hn;            /* busy servers in heap                */
+    int *otk,*osv;     /* owner index slots:  token & server, */
+    int om;            /* osv -1 when empty; slots-1          */
+  };
+
+/* facility queue:  a heap of queued elements, kept in descending    */
+/* priority (l5) order.  Within a priority class entries for preempt- */
+/* ed tokens (l4, the remaining event time, >0) come first, most re-  */
+/* cent first, then the others in arrival order.  That order is kept  */
+/* in the queued element's l1, unused as a link while queued:  pre-   */
+/* empted entries take -seq, others +seq.                             */
+struct fque
+  {
+    int *hp;           /* queued elements                     */
+    int cap;           /* hp capacity, l3[f] is its length    */
+    int seq;           /* arrivals since the queue was empty  */
+  };
+
+static struct fque
+  **fqx;             /* facility queues, l1[f+1] holds the  */
+                     /* queue number + 1 (0 until needed)   */
+static int
+  nfqx,              /* facility queues defined             */
+  cfqx;              /* fqx capacity                        */
+
+static void que_push(int f, int elm);
+static int que_pop(int f);
+
+static struct fsrv
+  **fsx;             /* server indexes                      */
+static int
+  nfsx,              /* server indexes defined              */
+  cfsx;              /* fsx capacity                        */
+
+static void srv_new(int f, int n);
+static void srv_free(struct fsrv *x);
+static int srv_first(struct fsrv *x);
+static void srv_heap_set(struct fsrv *x, int i, int k);
+static void srv_sift(struct fsrv *x, int i);
+static int srv_owned(struct fsrv *x, int tkn);
+static void srv_take(struct fsrv *x, int k);
+static void srv_give(struct fsrv *x, int k);
+
+int
+  recording;         /* set while recording, read by rand.c */
+
+#define evslot(ev) ((ev)<0? 0:((ev)<SMPL_EVTYPES? (ev):SMPL_EVTYPES-1))
 
 
 static real
@@ -61,6 +149,12 @@ void smpl(int m, char *s)
       display=opf=stdout;    /* inicializacao e feita aqui */
       blk=1; avl=-1; avn=0;       /* element pool & namespace headers */
       evl=fchn=0;           /* event list & descriptor chain headers  */
+      evn=evx=nel=0; nsch=ncau=0;        /* event list & pool counts  */
+      memset(&cnt,0,sizeof(cnt));
+      for (i=0; i<nfsx; i++) srv_free(fsx[i]);
+      nfsx=0;
+      for (i=0; i<nfqx; i++) {free(fqx[i]->hp); free(fqx[i]);}
+      nfqx=0;
       clock=start=tl=0.0;   /* sim., interval start, last trace times */
       event=tr=0;                 /* current event no. & trace flags  */
       for (i=0; i<nl; i++)  {l1[i]=l2[i]=l3[i]=0; l4[i]=l5[i]=0.0;}
@@ -74,6 +168,7 @@ void smpl(int m, char *s)
 void reset()
   {
     resetf(); start=clock;
+    if (rec) then rec_op('Z');
   }
 
 /*---------------------------  SAVE NAME  ----------------------------*/
@@ -120,16 +215,17 @@ static int get_elm()
         /* build the free element list from the block of elements */
         /* remaining after all facilities have been defined       */
         for (i=blk; i<(nl-1); i++) l1[i]=i+1;
-        avl=blk; blk=0;
+        cnt.blocks=blk-1; avl=blk; blk=0;
       }
     i=avl; avl=l1[i];
+    if (++nel>cnt.pool_max) then cnt.pool_max=nel;
     return(i);
   }
 
 /*-------------------------  RETURN ELEMENT  -------------------------*/
 static void put_elm(int i)
     {
-      l1[i]=avl; avl=i;
+      l1[i]=avl; avl=i; nel--;
     }
 
 /*-------------------------  SCHEDULE EVENT  -------------------------*/
@@ -138,7 +234,10 @@ void schedule(int ev, real te, int tkn)
       int i;
       if (te<0.0) then error(4,0); /* negative event time */
       i=get_elm(); l2[i]=tkn; l3[i]=ev; l4[i]=0.0; l5[i]=clock+te;
-      enlist(&evl,i);
+      enlist(&evl,i); nsch++; if (++evn>evx) then evx=evn;
+      cnt.scheduled[evslot(ev)]++;
+      if (rec) then {rec_op('S'); rec_int(ev); rec_real(te); rec_int(tkn);}
+      PROBE3(smpl,schedule,ev,tkn,evn);
       if (tr) then msg(1,tkn,"",ev,0);
     }
 
@@ -149,10 +248,50 @@ void cause(int *ev, int *tkn)
       if (evl==0) then error(5,0);          /* empty event list  */
       i=evl; *tkn=token=l2[i]; *ev=event=l3[i]; clock=l5[i];
       evl=l1[i]; put_elm(i);  /* delink element & return to pool */
+      evn--; ncau++; cnt.caused[evslot(event)]++;
+      if (rec) then {rec_op('C'); rec_int(event); rec_int(token); rec_real(clock);}
+      PROBE3(smpl,cause,event,token,evn);
       if (tr) then msg(2,*tkn,"",event,0);
    /*   if (mr && (tr!=3)) then mtr(tr,0);*/
     }
 
+/*--------------------  CAUSE SIMULTANEOUS EVENTS  -------------------*/
+int cause_batch(int *ev, int *tkn, int max)
+    { /* dequeue the events sharing the earliest event time, up to    */
+      /* 'max' of them, into ev & tkn in list order, and return their */
+      /* number.  Dequeued events can no longer be cancelled.  This   */
+      /* matches many 'cause' calls only if handling the batch never  */
+      /* releases a facility with requests queued:  'release' puts    */
+      /* the request it wakes at the head of the event list, ahead of */
+      /* the rest of the batch, and 'cause' would run it next         */
+      int i,n=0;
+      if (evl==0) then error(5,0);          /* empty event list  */
+      clock=l5[evl];
+      while ((n<max) && (evl!=0) && (l5[evl]==clock))
+        {
+          i=evl; tkn[n]=token=l2[i]; ev[n]=event=l3[i];
+          evl=l1[i]; put_elm(i);
+          evn--; ncau++; cnt.caused[evslot(event)]++;
+          if (rec) then {rec_op('C'); rec_int(event); rec_int(token); rec_real(clock);}
+          PROBE3(smpl,cause,event,token,evn);
+          if (tr) then msg(2,token,"",event,0);
+          n++;
+        }
+      return(n);
+    }
+
+/*--------------------------  UNCAUSE EVENT  -------------------------*/
+void uncause(int ev, int tkn)
+    { /* return an event dequeued at the current time but not handled */
+      /* to the head of the event list, undoing its 'cause':  events  */
+      /* left in a batch go back last first to keep their order       */
+      int i;
+      i=get_elm(); l2[i]=tkn; l3[i]=ev; l4[i]=0.0; l5[i]=clock;
+      l1[i]=evl; evl=i; if (++evn>evx) then evx=evn;
+      ncau--; cnt.caused[evslot(ev)]--;
+      if (rec) then {rec_op('U'); rec_int(ev); rec_int(tkn);}
+    }
+
 /*--------------------------  RETURN TIME  ---------------------------*/
 double time()
   {
@@ -164,15 +303,47 @@ int cancel(int ev)
     {
       int pred,succ=evl,tkn;
       while((succ!=0) && (l3[succ]!=ev)) {pred=succ; succ=l1[pred];}
+      if (succ==0) then tkn=-1; else tkn=l2[succ];
+      if (rec) then {rec_op('X'); rec_int(ev); rec_int(tkn);}
       if (succ==0) then return(-1);
-      tkn=l2[succ]; if (tr) then msg(3,tkn,"",l3[succ],0);
+      if (tr) then msg(3,tkn,"",l3[succ],0);
       if (succ==evl)
         then evl=l1[succ];                 /* unlink  event */
         else l1[pred]=l1[succ];            /* list entry &  */
-      put_elm(succ);                       /* deallocate it */
+      put_elm(succ); evn--;                /* deallocate it */
       return(tkn);
     }
 
+/*-------------------  ADVANCE PERIODIC EVENTS  ----------------------*/
+long advance(int ev, real dt, real lim)
+    { /* for 'ev' events that reschedule themselves every 'dt': skip  */
+      /* the most whole periods that keep all of them ahead of every  */
+      /* other event & of 'lim', accounting each skipped period as   */
+      /* one schedule & cause per event.  Return the periods skipped */
+      int i,m=0; long k=0; real last=0.0,bnd=lim;
+      for (i=evl; (i!=0) && (l3[i]==ev); i=l1[i]) {last=l5[i]; m++;}
+      if ((i!=0) && (l5[i]<bnd)) then bnd=l5[i];
+      if ((m>0) && (dt>0.0) && (last<bnd))
+        then
+          {
+            k=(long)((bnd-last)/dt);
+            while ((k>0) && (last+k*dt>=bnd)) k--;
+          }
+      if (k>0) then
+        { /* the moved events still lead the list, in the same order  */
+          for (i=evl; (i!=0) && (l3[i]==ev); i=l1[i]) l5[i]+=k*dt;
+          nsch+=k*m; ncau+=k*m;
+          cnt.scheduled[evslot(ev)]+=k*m; cnt.caused[evslot(ev)]+=k*m;
+        }
+      if (rec) then
+        {
+          int64_t v=k;
+          rec_op('A'); rec_int(ev); rec_real(dt); rec_real(lim);
+          fwrite(&v,sizeof(v),1,rec);
+        }
+      return(k);
+    }
+
 /*-------------------------  SUSPEND EVENT  --------------------------*/
 static int suspend(int tkn)
     {
@@ -182,39 +353,24 @@ static int suspend(int tkn)
       if (succ==evl)
         then evl=l1[succ];       /* unlink  event */
         else l1[pred]=l1[succ];  /* list entry    */
+      evn--;
       if (tr) then msg(6,-1,"",l3[succ],0);
       return(succ);
     }
 
-/*--------------  ENTER ELEMENT IN QUEUE OR EVENT LIST  --------------*/
+/*-------------------  ENTER ELEMENT IN EVENT LIST  ------------------*/
 static void enlist(int *head, int elm)
-    { /* 'head' points to head of queue/event list */
-      int pred,succ; real arg,v;
+    { /* 'head' points to head of event list (facility queues are     */
+      /* heaps, see 'enqueue')                                         */
+      int pred,succ,n=0; real arg;
       arg=l5[elm]; succ=*head;
       while (1)
         { /* scan for position to insert entry:  event list is order- */
-          /* ed in ascending 'arg' values, queues in descending order */
-          if (succ==0)
-            then break;  /* end of list */
-            else
-              {
-                v=l5[succ];
-                if (*head==evl)
-                  then
-                    { /* event list  */
-                      if (v>arg) then break;
-                    }
-                  else
-                    { /* queue: if entry is for a preempted token     */
-                      /* (l4, the remaining event time, >0), insert   */
-                      /* entry at beginning of its priority class;    */
-                      /* otherwise, insert it at the end              */
-                      if ((v<arg) || ((v==arg) && (l4[elm]>0.0)))
-                        then break;
-                    }
-              }
-          pred=succ; succ=l1[pred];
+          /* ed in ascending 'arg' values                              */
+          if ((succ==0) || (l5[succ]>arg)) then break;
+          pred=succ; succ=l1[pred]; n++;
         }
+      cnt.enlists++; cnt.scans+=n; if (n>cnt.scan_max) then cnt.scan_max=n;
       l1[elm]=succ; if (succ!=*head) then l1[pred]=elm; else *head=elm;
     }
 
@@ -222,11 +378,17 @@ static void enlist(int *head, int elm)
 int facility(char *s, int n)
     {
       int f,i;
-      f=get_blk(n+2); l1[f]=n; l3[f+1]=save_name(s,(n>1 ? 14:17));
+      f=get_blk(n+3); l1[f]=n; l3[f+1]=save_name(s,(n>1 ? 14:17));
       if (fchn==0)
         then fchn=f;
         else {i=fchn; while(l2[i+1]) i=l2[i+1]; l2[i+1]=f;}
+      if (n>1) then srv_new(f,n);
       if (tr) then msg(13,-1,fname(f),f,0);
+      if (rec) then
+        {
+          rec_op('F'); rec_int(n); rec_int(f); rec_int(strlen(s));
+          fwrite(s,1,strlen(s),rec);
+        }
       return(f);
     }
 
@@ -237,7 +399,7 @@ static void resetf()
       while (i)
         {
           l4[i]=l4[i+1]=l5[i+1]=0.0;
-          for (j=i+2; j<=(i+l1[i]+1); j++) {l3[j]=0; l4[j]=0.0;}
+          for (j=i+2; j<=(i+l1[i]+2); j++) {l3[j]=0; l4[j]=0.0;}
           i=l2[i+1];  /* advance to next facility */
         }
     start=clock;
@@ -246,18 +408,21 @@ static void resetf()
 /*------------------------  REQUEST FACILITY  ------------------------*/
 int request(int f, int tkn, int pri)
     {
-      int i,r;
+      int i,r; struct fsrv *x;
       if (l2[f]<l1[f])
         then
           { /* facility nonbusy - reserve 1st-found nonbusy server    */
-            for (i=f+2; l1[i]!=0; i++);
+            if ((x=fsv(f))) then i=srv_first(x);
+              else for (i=f+2; l1[i]!=0; i++);
             l1[i]=tkn; l2[i]=pri; l5[i]=clock; l2[f]++; r=0;
+            if (x) then srv_take(x,i);
           }
         else
           { /* facility busy - enqueue token marked w/event, priority */
             enqueue(f,tkn,pri,event,0.0); r=1;
           }
       if (tr) then msg(7,tkn,fname(f),r,l3[f]);
+      if (rec) then {rec_op('Q'); rec_int(f); rec_int(tkn); rec_int(pri); rec_int(r);}
       return(r);
     }
 
@@ -267,23 +432,70 @@ static void enqueue(int f, int j, int pri, int ev, real te)
       int i;
       l5[f+1]+=l3[f]*(clock-l5[f]); l3[f]++; l5[f]=clock;
       i=get_elm(); l2[i]=j; l3[i]=ev; l4[i]=te; l5[i]=(real)pri;
-      enlist(&l1[f+1],i);
+      que_push(f,i);
+    }
+
+/*-----------------------  FACILITY QUEUE HEAP  ----------------------*/
+#define qbefore(a,b) ((l5[a]>l5[b]) || ((l5[a]==l5[b]) && (l1[a]<l1[b])))
+
+static void que_push(int f, int elm)
+    { /* insert elm in f's queue, l3[f] already counts it */
+      struct fque *q; int i=l3[f]-1,p;
+      if (l1[f+1]==0) then
+        { /* first use of this facility's queue */
+          if (nfqx==cfqx) then
+            {
+              cfqx=cfqx? 2*cfqx:16;
+              fqx=(struct fque **)realloc(fqx,cfqx*sizeof(*fqx));
+              if (fqx==NULL) then error(1,0);
+            }
+          if ((q=(struct fque *)calloc(1,sizeof(*q)))==NULL) then error(1,0);
+          fqx[nfqx++]=q; l1[f+1]=nfqx;
+        }
+      q=fqx[l1[f+1]-1];
+      if (i==0) then q->seq=0;
+      if (i>=q->cap) then
+        {
+          q->cap=q->cap? 2*q->cap:8;
+          q->hp=(int *)realloc(q->hp,q->cap*sizeof(int));
+          if (q->hp==NULL) then error(1,0);
+        }
+      q->seq++; l1[elm]=(l4[elm]>0.0)? -q->seq:q->seq;
+      while ((i>0) && qbefore(elm,q->hp[p=(i-1)/2])) {q->hp[i]=q->hp[p]; i=p;}
+      q->hp[i]=elm;
+    }
+
+static int que_pop(int f)
+    { /* remove & return the head of f's queue, l3[f] still counts it */
+      struct fque *q=fqx[l1[f+1]-1];
+      int top=q->hp[0],n=l3[f]-1,last=q->hp[n],i=0,c;
+      while ((c=2*i+1)<n)
+        {
+          if ((c+1<n) && qbefore(q->hp[c+1],q->hp[c])) then c++;
+          if (!qbefore(q->hp[c],last)) then break;
+          q->hp[i]=q->hp[c]; i=c;
+        }
+      if (n>0) then q->hp[i]=last;
+      return(top);
     }
 
 /*------------------------  PREEMPT FACILITY  ------------------------*/
 int preempt(int f, int tkn, int pri)
     {
-      int ev,i,j,k,r; real te;
+      int ev,i,j,k,r; real te; struct fsrv *x=fsv(f);
       if (l2[f]<l1[f])
         then
           { /* facility nonbusy - locate 1st-found nonbusy server     */
-            for (k=f+2; l1[k]!=0; k++); r=0;
+            if (x) then k=srv_first(x);
+              else for (k=f+2; l1[k]!=0; k++);
+            r=0;
             if (tr) then msg(8,tkn,fname(f),0,0);
           }
         else
           { /* facility busy - find server with lowest-priority user  */
             k=f+2; j=l1[f]+f+1;  /* indices of server elements 1 & n  */
-            for (i=f+2; i<=j; i++) if (l2[i]<l2[k]) then k=i;
+            if (x) then k=x->hp[0];
+              else for (i=f+2; i<=j; i++) if (l2[i]<l2[k]) then k=i;
             if (pri<=l2[k])
               then
                 { /* requesting token's priority is not higher than   */
@@ -307,30 +519,38 @@ int preempt(int f, int tkn, int pri)
                   if (tr) then
                     {msg(10,-1,"",j,l3[f]); msg(12,-1,fname(f),tkn,0);}
                   l3[k]++; l4[k]+=clock-l5[k];
+                  l3[fst(f)]++; l4[fst(f)]+=clock-l5[k];
                   l2[f]--; l4[f+1]++; r=0;
+                  if (x) then srv_give(x,k);
                 }
           }
       if (r==0) then
         { /* reserve server k of facility */
           l1[k]=tkn; l2[k]=pri; l5[k]=clock; l2[f]++;
+          if (x) then srv_take(x,k);
         }
+      if (rec) then {rec_op('P'); rec_int(f); rec_int(tkn); rec_int(pri); rec_int(r);}
       return(r);
     }
 
 /*------------------------  RELEASE FACILITY  ------------------------*/
 void release(int f, int tkn)
     {
-      int i,j=0,k,m; real te;
+      int i,j=0,k,m; real te; struct fsrv *x=fsv(f);
       /* locate server (j) reserved by releasing token */
       k=f+1+l1[f];     /* index of last server element */
-      for (i=f+2; i<=k; i++) if (l1[i]==tkn) then {j=i; break;}
+      if (x) then j=srv_owned(x,tkn);
+        else for (i=f+2; i<=k; i++) if (l1[i]==tkn) then {j=i; break;}
       if (j==0) then error(7,0); /* no server reserved */
+      if (rec) then {rec_op('R'); rec_int(f); rec_int(tkn);}
+      if (x) then srv_give(x,j);
       l1[j]=0; l3[j]++; l4[j]+=clock-l5[j]; l2[f]--;
+      l3[fst(f)]++; l4[fst(f)]+=clock-l5[j];
       if (tr) then msg(9,tkn,fname(f),0,0);
       if (l3[f]>0) then
         { /* queue not empty:  dequeue request ('k' =  */
           /* index of element) & update queue measures */
-          k=l1[f+1]; l1[f+1]=l1[k]; te=l4[k];
+          k=que_pop(f); te=l4[k];
           l5[f+1]+=l3[f]*(clock-l5[f]); l3[f]--; l4[f]++; l5[f]=clock;
           if (tr) then msg(11,-1,"",l2[k],l3[f]);
           if (te==0.0) then
@@ -344,10 +564,115 @@ void release(int f, int tkn)
               { /* return after preemption:  reserve facility for de- */
                 /* queued request & reschedule remaining event time   */
                 l1[j]=l2[k]; l2[j]=(int)l5[k]; l5[j]=clock; l2[f]++;
+                if (x) then srv_take(x,j);
                 if (tr) then msg(12,-1,fname(f),l2[k],0);
                 l5[k]=clock+te; enlist(&evl,k); m=5;
               }
           if (tr) then msg(m,-1,"",l3[k],0);
+          if (++evn>evx) then evx=evn;
+        }
+    }
+
+/*-----------------------  BUILD SERVER INDEX  -----------------------*/
+static void srv_new(int f, int n)
+    {
+      struct fsrv *x; int s,w=(n+63)/64,m=1;
+      while (m<2*n) m<<=1;
+      if (nfsx==cfsx) then
+        {
+          cfsx=cfsx? 2*cfsx:16;
+          fsx=(struct fsrv **)realloc(fsx,cfsx*sizeof(*fsx));
+          if (fsx==NULL) then error(1,0);
+        }
+      x=(struct fsrv *)calloc(1,sizeof(*x));
+      if (x==NULL) then error(1,0);
+      x->f=f; x->n=n; x->om=m-1;
+      x->fre=(uint64_t *)calloc(w,sizeof(uint64_t));
+      x->sum=(uint64_t *)calloc((w+63)/64,sizeof(uint64_t));
+      x->hp=(int *)malloc(n*sizeof(int));
+      x->pos=(int *)malloc(n*sizeof(int));
+      x->otk=(int *)malloc(m*sizeof(int));
+      x->osv=(int *)malloc(m*sizeof(int));
+      if (!x->fre || !x->sum || !x->hp || !x->pos || !x->otk || !x->osv)
+        then error(1,0);
+      for (s=0; s<n; s++)
+        {x->fre[s/64]|=1ULL<<(s%64); x->sum[s/4096]|=1ULL<<((s/64)%64); x->pos[s]=-1;}
+      for (s=0; s<m; s++) x->osv[s]=-1;
+      fsx[nfsx++]=x; l1[fst(f)]=nfsx;
+    }
+
+static void srv_free(struct fsrv *x)
+    {
+      free(x->fre); free(x->sum); free(x->hp); free(x->pos);
+      free(x->otk); free(x->osv); free(x);
+    }
+
+/*-------------------  LOWEST-NUMBERED FREE SERVER  ------------------*/
+static int srv_first(struct fsrv *x)
+    { /* bitmap scan:  one summary word covers 4096 servers */
+      int v,w;
+      for (v=0; !x->sum[v]; v++);
+      w=v*64+__builtin_ctzll(x->sum[v]);
+      return(x->f+2+w*64+__builtin_ctzll(x->fre[w]));
+    }
+
+/*-------------------------  SERVER HEAP  ----------------------------*/
+#define hless(a,b) ((l2[a]<l2[b]) || ((l2[a]==l2[b]) && ((a)<(b))))
+
+static void srv_heap_set(struct fsrv *x, int i, int k)
+    {
+      x->hp[i]=k; x->pos[k-x->f-2]=i;
+    }
+
+static void srv_sift(struct fsrv *x, int i)
+    { /* restore heap order around position i */
+      int k=x->hp[i],c;
+      while ((i>0) && hless(k,x->hp[(i-1)/2]))
+        {srv_heap_set(x,i,x->hp[(i-1)/2]); i=(i-1)/2;}
+      while ((c=2*i+1)<x->hn)
+        {
+          if ((c+1<x->hn) && hless(x->hp[c+1],x->hp[c])) then c++;
+          if (!hless(x->hp[c],k)) then break;
+          srv_heap_set(x,i,x->hp[c]); i=c;
+        }
+      srv_heap_set(x,i,k);
+    }
+
+/*------------------------  OWNER INDEX  -----------------------------*/
+#define ohash(x,t) ((int)(((unsigned)(t)*2654435761u)&(unsigned)(x)->om))
+
+static int srv_owned(struct fsrv *x, int tkn)
+    { /* lowest-numbered server reserved by tkn, 0 if none */
+      int i,j=0;
+      for (i=ohash(x,tkn); x->osv[i]>=0; i=(i+1)&x->om)
+        if ((x->otk[i]==tkn) && ((j==0) || (x->osv[i]<j))) then j=x->osv[i];
+      return(j);
+    }
+
+/*----------------------  MARK SERVER BUSY/FREE  ---------------------*/
+static void srv_take(struct fsrv *x, int k)
+    { /* server k has just been reserved for token l1[k], priority l2[k] */
+      int s=k-x->f-2,i;
+      x->fre[s/64]&=~(1ULL<<(s%64));
+      if (!x->fre[s/64]) then x->sum[s/4096]&=~(1ULL<<((s/64)%64));
+      i=x->hn++; srv_heap_set(x,i,k); srv_sift(x,i);
+      for (i=ohash(x,l1[k]); x->osv[i]>=0; i=(i+1)&x->om);
+      x->otk[i]=l1[k]; x->osv[i]=k;
+    }
+
+static void srv_give(struct fsrv *x, int k)
+    { /* server k is about to be freed, l1[k] & l2[k] still hold its user */
+      int s=k-x->f-2,i,j,h;
+      x->fre[s/64]|=1ULL<<(s%64); x->sum[s/4096]|=1ULL<<((s/64)%64);
+      i=x->pos[s]; x->pos[s]=-1;
+      if (i!=--x->hn) then {srv_heap_set(x,i,x->hp[x->hn]); srv_sift(x,i);}
+      for (i=ohash(x,l1[k]); x->osv[i]!=k; i=(i+1)&x->om);
+      x->osv[i]=-1;
+      for (j=(i+1)&x->om; x->osv[j]>=0; j=(j+1)&x->om)
+        { /* backward-shift the probe chain over the emptied slot */
+          h=ohash(x,x->otk[j]);
+          if ((j>i)? ((h<=i) || (h>j)):((h<=i) && (h>j))) then
+            {x->otk[i]=x->otk[j]; x->osv[i]=x->osv[j]; x->osv[j]=-1; i=j;}
         }
     }
 
@@ -366,20 +691,14 @@ int inq(int f)
 /*--------------------  GET FACILITY UTILIZATION  --------------------*/
 double U(int f)
     {
-      int i; real b=0.0,t=clock-start;
-      if (t>0.0) then
-        {
-          for (i=f+2; i<=f+l1[f]+1; i++) b+=l4[i];
-          b/=t;
-        }
-      return(b);
+      real t=clock-start;
+      return((t>0.0)? (l4[fst(f)]/t):0.0);
     }
 
 /*----------------------  GET MEAN BUSY PERIOD  ----------------------*/
 double B(int f)
     {
-      int i,n=0; real b=0.0;
-      for (i=f+2; i<=f+l1[f]+1; i++) {b+=l4[i]; n+=l3[i];}
+      int n=l3[fst(f)]; real b=l4[fst(f)];
       return((n>0)? b/n:b);
     }
 
@@ -524,7 +843,7 @@ void reportf()
 /*----------------------  GENERATE REPORT PAGE  ----------------------*/
 static int rept_page(int fnxt)
     {
-      int f,i,n; char fn[19];
+      int f,n; char fn[19];
       static char *s[7]={
         "smpl SIMULATION REPORT", " MODEL: ", "TIME: ", "INTERVAL: ",
         "MEAN BUSY     MEAN QUEUE        OPERATION COUNTS",
@@ -538,7 +857,7 @@ static int rept_page(int fnxt)
       f=fnxt; lft-=8;
       while (f && lft--)
         {
-          n=0; for (i=f+2; i<=f+l1[f]+1; i++) n+=l3[i];
+          n=l3[fst(f)];
           if (l1[f]==1)
             then sprintf(fn,"%s",fname(f));
             else sprintf(fn,"%s[%d]",fname(f),l1[f]);
@@ -549,6 +868,147 @@ static int rept_page(int fnxt)
       return(f);
     }
 
+/*------------------------  EMIT QUOTED NAME  ------------------------*/
+static void put_name(FILE *dest, char *s, int fmt)
+    { /* JSON escapes quotes & backslashes, CSV doubles quotes */
+      putc('"',dest);
+      for (; *s; s++)
+        {
+          if (*s=='"') then putc((fmt&SMPL_JSON)? '\\':'"',dest);
+          if ((fmt&SMPL_JSON) && (*s=='\\')) then putc('\\',dest);
+          if ((fmt&SMPL_JSON) && ((unsigned char)*s<0x20))
+            then fprintf(dest,"\\u%04x",*s);
+            else putc(*s,dest);
+        }
+      putc('"',dest);
+    }
+
+/*--------------------  EMIT MACHINE-READABLE STATS  -----------------*/
+void stats(FILE *dest, int fmt)
+    { /* one pass over the facility chain;  every figure is maintained */
+      /* incrementally, so a sample costs O(1) per facility.  JSON is  */
+      /* a single line per call, CSV one row per facility (or a single */
+      /* row with empty facility fields if none is defined), each row */
+      /* repeating the model & event list figures, the same fields as */
+      /* JSON's.  SMPL_HEADER adds the CSV column names.               */
+      int f=fchn,first=1;
+      if (fmt&SMPL_JSON) then
+        {
+          fprintf(dest,"{\"model\":"); put_name(dest,mname(),fmt);
+          fprintf(dest,",\"time\":%.6f,\"interval\":%.6f",clock,clock-start);
+          fprintf(dest,",\"events\":{\"depth\":%d,\"max_depth\":%d,"
+            "\"scheduled\":%ld,\"caused\":%ld,\"pool_used\":%d,"
+            "\"pool_size\":%d},\"facilities\":[",evn,evx,nsch,ncau,nel,nl);
+          for (; f; f=l2[f+1])
+            {
+              if (!first) then putc(',',dest);
+              first=0;
+              fprintf(dest,"{\"id\":%d,\"name\":",f); put_name(dest,fname(f),fmt);
+              fprintf(dest,",\"servers\":%d,\"busy\":%d,\"inq\":%d,"
+                "\"util\":%.6f,\"mean_busy\":%.6f,\"mean_queue\":%.6f,"
+                "\"releases\":%d,\"preempts\":%d,\"queued\":%d}",
+                l1[f],l2[f],l3[f],U(f),B(f),Lq(f),l3[fst(f)],
+                (int)l4[f+1],(int)l4[f]);
+            }
+          fprintf(dest,"]}\n");
+        }
+      else if (fmt&SMPL_CSV) then
+        {
+          if (fmt&SMPL_HEADER) then
+            fprintf(dest,"model,time,interval,depth,max_depth,scheduled,caused,"
+              "pool_used,pool_size,facility,name,servers,busy,inq,util,"
+              "mean_busy,mean_queue,releases,preempts,queued\n");
+          do
+            {
+              put_name(dest,mname(),fmt);
+              fprintf(dest,",%.6f,%.6f,%d,%d,%ld,%ld,%d,%d,",
+                clock,clock-start,evn,evx,nsch,ncau,nel,nl);
+              if (f)
+                then
+                  {
+                    fprintf(dest,"%d,",f); put_name(dest,fname(f),fmt);
+                    fprintf(dest,",%d,%d,%d,%.6f,%.6f,%.6f,%d,%d,%d\n",
+                      l1[f],l2[f],l3[f],U(f),B(f),Lq(f),l3[fst(f)],
+                      (int)l4[f+1],(int)l4[f]);
+                    f=l2[f+1];
+                  }
+                else fprintf(dest,",,,,,,,,,,\n");
+            }
+          while (f);
+        }
+    }
+
+/*---------------------  RECORD OPERATION TRACE  ---------------------*/
+/* the trace is the magic "SMPLTRC1" followed by one record per call, */
+/* a 1-byte opcode & its fields, in host byte order:                  */
+/*   F n f len name   facility          Q f tkn pri r  request         */
+/*   S ev te tkn      schedule          P f tkn pri r  preempt         */
+/*   C ev tkn clock   cause             R f tkn        release         */
+/*   X ev tkn         cancel            Z              reset           */
+/*   D v              ranf draw         T n            stream          */
+/*   K Ik n           seed              E ops clock    end of trace    */
+/*   A ev dt lim k    advance           U ev tkn       uncause         */
+/* ints are 4 bytes, 'te', 'clock', 'dt', 'lim' & 'v' 8-byte doubles, */
+/* 'Ik', 'ops' & 'k' 8 bytes.  Results (f, r, cause's fields, cancel's */
+/* tkn, v, k) are what smpl_replay checks a new engine against.       */
+static long nrec;    /* operations recorded */
+
+static void rec_op(char op)
+    {
+      putc(op,rec); nrec++;
+    }
+
+static void rec_int(int v)
+    {
+      int32_t i=v; fwrite(&i,sizeof(i),1,rec);
+    }
+
+static void rec_real(real v)
+    {
+      fwrite(&v,sizeof(v),1,rec);
+    }
+
+int record(char *path)
+    { /* start recording to 'path', return 0 or -1 if it can't be opened */
+      int n;
+      if (rec) then record_end();
+      if ((rec=fopen(path,"wb"))==NULL) then return(-1);
+      setvbuf(rec,NULL,_IOFBF,1<<16);
+      fwrite("SMPLTRC1",1,8,rec); nrec=0; recording=1;
+      /* start from the current stream & seed: replay needs them to   */
+      /* reproduce the draws even if earlier ones went unrecorded     */
+      n=stream(0); record_rng('T',0L,n,0.0); record_rng('K',seed(0L,n),n,0.0);
+      return(0);
+    }
+
+void record_end()
+  {
+    int64_t n;
+    if (rec==NULL) then return;
+    n=nrec; putc('E',rec); fwrite(&n,sizeof(n),1,rec); rec_real(clock);
+    fclose(rec); rec=NULL; recording=0;
+  }
+
+void record_rng(int op, long a, int n, double v)
+    { /* called by rand.c while 'recording' is set */
+      int64_t ik=a;
+      if (rec==NULL) then return;
+      rec_op((char)op);
+      switch(op)
+        {
+          case 'D': rec_real(v); break;
+          case 'T': rec_int(n); break;
+          case 'K': fwrite(&ik,sizeof(ik),1,rec); rec_int(n); break;
+        }
+    }
+
+/*-----------------------  GET HOT-PATH COUNTERS  --------------------*/
+struct smpl_counts *counts()
+  {
+    cnt.list_len=evn; cnt.pool_used=nel; cnt.pool_size=nl;
+    return(&cnt);
+  }
+
 /*---------------------------  COUNT LINES  --------------------------*/
 int lns(int i)
     {
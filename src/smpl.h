@@ -12,10 +12,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>     /* should include a declaration for 'atof' */
+#include <stdint.h>
 
 typedef double real;
 #define then    
 
+/* ---------------------- stats formats -----------------------------*/
+#define SMPL_JSON   1
+#define SMPL_CSV    2
+#define SMPL_HEADER 4   /* or'ed with SMPL_CSV: emit column names */
+
+/* ---------------------- hot-path counters -------------------------*/
+#define SMPL_EVTYPES 16 /* events >= this share the last slot */
+
+struct smpl_counts
+  {
+    long scheduled[SMPL_EVTYPES];  /* 'schedule' calls per event     */
+    long caused[SMPL_EVTYPES];     /* 'cause' calls per event        */
+    long enlists;                  /* event list insertions          */
+    long scans;                    /* elements passed over by them   */
+    int  scan_max;                 /* longest single scan            */
+    int  pool_max;                 /* element pool high-water mark   */
+    int  blocks;                   /* elements reserved by facilities */
+    int  list_len;                 /* events pending, and            */
+    int  pool_used;                /* elements in use, at 'counts'   */
+    int  pool_size;                /* element pool length            */
+  };
+
 /* ---------------------- rand names --------------------------------*/
 extern double ranf();
 extern int stream(int n);
@@ -43,7 +66,11 @@ static int get_elm();
 static void put_elm(int i);
 extern void schedule(int ev, real te, int tkn);
 extern void cause(int *ev, int *tkn);
+/* cause_batch: not for models whose facilities queue, see smpl.c */
+extern int cause_batch(int *ev, int *tkn, int max);
+extern void uncause(int ev, int tkn);
 extern int cancel(int ev);  
+extern long advance(int ev, real dt, real lim);
 static int suspend(int tkn); 
 static void enlist(int *head, int elm);  
 extern int facility(char *s, int n);
@@ -62,6 +89,11 @@ extern void error(int n, char *s);
 extern void report(); 
 extern void reportf();
 static int rept_page(int fnxt);
+extern void stats(FILE *dest, int fmt);
+extern struct smpl_counts *counts();
+extern int record(char *path);
+extern void record_end();
+extern void record_rng(int op, long a, int n, double v);
 extern int lns(int i); 
 extern void endpage();
 extern void newpage(); 
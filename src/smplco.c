@@ -0,0 +1,273 @@
+/* Processos do smpl como corrotinas
+ * Funcionalidade: troca de contexto em assembly no x86-64 (ucontext nas
+ * demais arquiteturas) e pilhas pequenas reaproveitadas de blocos mmap.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "smpl.h"
+#include "smplco.h"
+
+#if !defined(__x86_64__) && !defined(SMPLCO_UCONTEXT)
+#define SMPLCO_UCONTEXT
+#endif
+
+#ifdef SMPLCO_UCONTEXT
+#include <ucontext.h>
+#endif
+
+// stacks mapped at once, enough for small models in a single mmap
+#define SLAB_STACKS 256
+// written at the lowest word of every stack, checked on each switch out
+#define CANARY 0x5350434f53504c4dULL
+
+typedef struct {
+#ifdef SMPLCO_UCONTEXT
+    ucontext_t uc;
+#else
+    void *sp; // saved stack pointer while suspended
+#endif
+    char *stack; // lowest address, NULL for a free slot
+    CoBody body;
+    void *arg;
+} Co;
+
+static Co *coros;
+static int co_max;
+static int co_ev;
+static size_t co_stack;
+static int current = -1;
+static int live;
+
+// free coroutine ids and stacks, used as stacks
+static int *free_ids;
+static int free_id_count;
+static int next_id; // ids below it have been handed out before
+static char **free_stacks;
+static int free_stack_count;
+
+// mapped slabs, kept to unmap them in co_end
+static char **slabs;
+static int slab_count;
+static int slab_cap;
+
+#ifdef SMPLCO_UCONTEXT
+static ucontext_t scheduler;
+#else
+static void *scheduler;
+
+/*
+ * co_switch saves the callee-saved registers on the current stack and
+ * its stack pointer in *from, then resumes the stack `to` was saved from.
+ * A fresh stack is laid out as if co_switch had been called from the
+ * coroutine entry (see co_spawn). It returns with an indirect jump: a
+ * `ret` to another stack always misses the return stack predictor, which
+ * made switches five times slower.
+ */
+void co_switch(void **from, void *to);
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".type co_switch, @function\n"
+    "co_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    popq %rcx\n"
+    "    jmpq *%rcx\n"
+    ".size co_switch, .-co_switch\n");
+#endif
+
+int co_init(int ev, int max, size_t stack_size) {
+    co_end();
+    co_ev = ev;
+    co_max = max;
+    // whole 16 byte units keep every stack top aligned
+    co_stack = ((stack_size ? stack_size : CO_STACK) + 15) & ~(size_t) 15;
+    coros = (Co*) calloc(max, sizeof(Co));
+    free_ids = (int*) malloc(sizeof(int)*max);
+    // slabs only get mapped while every stack is taken, so they never
+    // hold more than max stacks rounded up to a whole slab
+    free_stacks = (char**) malloc(sizeof(char*)*((max + SLAB_STACKS-1) / SLAB_STACKS) * SLAB_STACKS);
+    if (coros == NULL || free_ids == NULL || free_stacks == NULL) {
+        co_end();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * stack_get takes a stack from the pool, mapping a new slab when it's
+ * empty. Slabs are never handed back before co_end, pages only get
+ * committed as coroutines touch them.
+ */
+static char *stack_get(void) {
+    if (free_stack_count)
+        return free_stacks[--free_stack_count];
+
+    if (slab_count == slab_cap) {
+        slab_cap = slab_cap ? 2*slab_cap : 16;
+        slabs = (char**) realloc(slabs, sizeof(char*)*slab_cap);
+        if (slabs == NULL)
+            error(0, "could not allocate coroutine stacks");
+    }
+    char *slab = (char*) mmap(NULL, co_stack*SLAB_STACKS, PROT_READ|PROT_WRITE,
+                              MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (slab == MAP_FAILED)
+        error(0, "could not map coroutine stacks");
+    slabs[slab_count++] = slab;
+
+    for (int i=SLAB_STACKS-1; i > 0; i--)
+        free_stacks[free_stack_count++] = slab + i*co_stack;
+    return slab;
+}
+
+/*
+ * co_entry is where every coroutine starts: it runs the body and, once it
+ * returns, hands the slot and stack back and never gets resumed again.
+ */
+static void co_entry(void) {
+    Co *co = &coros[current];
+    co->body(co->arg);
+    // a body may overflow and return without yielding again
+    if (*(uint64_t*) co->stack != CANARY)
+        error(0, "coroutine stack overflow");
+
+    live--;
+    free_stacks[free_stack_count++] = co->stack;
+    free_ids[free_id_count++] = current;
+    co->stack = NULL;
+    current = -1;
+#ifdef SMPLCO_UCONTEXT
+    setcontext(&scheduler);
+#else
+    void *dead;
+    co_switch(&dead, scheduler);
+#endif
+}
+
+int co_spawn(CoBody body, void *arg, double delay) {
+    int id;
+    if (free_id_count)
+        id = free_ids[--free_id_count];
+    else if (next_id < co_max)
+        id = next_id++;
+    else {
+        error(0, "too many coroutines");
+        return -1;
+    }
+
+    Co *co = &coros[id];
+    co->stack = stack_get();
+    co->body = body;
+    co->arg = arg;
+    *(uint64_t*) co->stack = CANARY;
+#ifdef SMPLCO_UCONTEXT
+    getcontext(&co->uc);
+    co->uc.uc_stack.ss_sp = co->stack;
+    co->uc.uc_stack.ss_size = co_stack;
+    co->uc.uc_link = NULL;
+    makecontext(&co->uc, co_entry, 0);
+#else
+    // co_entry's return address slot, then co_switch's frame to pop
+    void **sp = (void**) (co->stack + co_stack);
+    *--sp = NULL;
+    *--sp = (void*) co_entry;
+    for (int i=0; i<6; i++)
+        *--sp = NULL;
+    co->sp = sp;
+#endif
+    live++;
+    schedule(co_ev, delay, id);
+    return id;
+}
+
+int co_self(void) {
+    return current;
+}
+
+int co_live(void) {
+    return live;
+}
+
+/*
+ * co_yield switches from the running coroutine back to the scheduler,
+ * returning when co_dispatch resumes it.
+ */
+static void co_yield(void) {
+    Co *co = &coros[current];
+    if (*(uint64_t*) co->stack != CANARY)
+        error(0, "coroutine stack overflow");
+    current = -1;
+#ifdef SMPLCO_UCONTEXT
+    swapcontext(&co->uc, &scheduler);
+#else
+    co_switch(&co->sp, scheduler);
+#endif
+}
+
+void co_hold(double dt) {
+    schedule(co_ev, dt, current);
+    co_yield();
+}
+
+void co_request(int f, int pri) {
+    // a queued request is put back on the event list by the release that
+    // frees f, resuming us to issue it again
+    while (request(f, current, pri) != 0)
+        co_yield();
+}
+
+void co_release(int f) {
+    release(f, current);
+}
+
+int co_dispatch(int ev, int tkn) {
+    if (ev != co_ev)
+        return 0;
+    current = tkn;
+#ifdef SMPLCO_UCONTEXT
+    swapcontext(&scheduler, &coros[tkn].uc);
+#else
+    co_switch(&scheduler, coros[tkn].sp);
+#endif
+    return 1;
+}
+
+void co_run(double until) {
+    int ev, tkn;
+    while (live > 0 && time() < until) {
+        cause(&ev, &tkn);
+        if (!co_dispatch(ev, tkn))
+            error(0, "event not meant for a coroutine");
+    }
+}
+
+void co_end(void) {
+    for (int i=0; i<slab_count; i++)
+        munmap(slabs[i], co_stack*SLAB_STACKS);
+    free(slabs);
+    free(coros);
+    free(free_ids);
+    free(free_stacks);
+    slabs = NULL;
+    coros = NULL;
+    free_ids = NULL;
+    free_stacks = NULL;
+    slab_count = slab_cap = 0;
+    free_id_count = free_stack_count = 0;
+    next_id = live = 0;
+    current = -1;
+}
@@ -0,0 +1,59 @@
+/* Processos do smpl como corrotinas
+ * Funcionalidade: cada entidade simulada roda como uma corrotina com pilha
+ * propria que chama co_hold(), co_request() e co_release() e devolve o
+ * controle ao escalonador, em vez de um laco de eventos com switch.
+ */
+
+#ifndef SMPLCO_H
+#define SMPLCO_H
+
+#include <stddef.h>
+
+// default stack size per coroutine, bytes
+#define CO_STACK 16384
+
+typedef void (*CoBody)(void *arg);
+
+/*
+ * co_init sets the layer up for at most `max` live coroutines, each with a
+ * `stack_size` bytes stack (0 for CO_STACK) carved out of pooled mmap'ed
+ * slabs and reused once its coroutine returns. Coroutines are resumed by
+ * smpl events numbered `ev`, with their id as the token, so a model can
+ * mix them with its own events. smpl must already be initialized, and its
+ * pool (SMPL_POOL) sized for the events and queue entries pending at once.
+ * Return 0, or -1 when memory can't be had.
+ */
+int co_init(int ev, int max, size_t stack_size);
+
+// spawn a coroutine running body(arg) `delay` from now, return its id
+int co_spawn(CoBody body, void *arg, double delay);
+
+// id of the running coroutine, -1 from the scheduler
+int co_self(void);
+
+// coroutines spawned and not yet returned
+int co_live(void);
+
+/*
+ * Called from a coroutine: co_hold suspends it for dt units of simulated
+ * time, co_request returns once it holds facility f (waiting in f's queue
+ * at priority pri if needed) and co_release frees f.
+ */
+void co_hold(double dt);
+void co_request(int f, int pri);
+void co_release(int f);
+
+/*
+ * co_dispatch runs coroutine `tkn` until it next suspends when `ev` is the
+ * coroutine event, as returned by cause(). Return 1 if it did, 0 for any
+ * other event.
+ */
+int co_dispatch(int ev, int tkn);
+
+// cause and dispatch events until `until` or no coroutine is left
+void co_run(double until);
+
+// release every stack slab and coroutine slot
+void co_end(void);
+
+#endif
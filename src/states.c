@@ -0,0 +1,753 @@
+/* Armazenamento de estados do simulador Vcube
+ * Funcionalidade: guarda o vetor de estados de cada processo, seja como
+ * uma matriz n x n densa ou como excecoes a um vetor base compartilhado.
+ *
+ * Kept apart from vcube.c as pthread.h pulls <time.h>, whose time()
+ * clashes with smpl's.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STATES_AVX2
+#endif
+
+#include "states.h"
+
+#define CACHE_LINE 64
+#define HUGE_PAGE (2UL << 20)
+
+typedef struct {
+    int *matrix;
+    size_t stride;
+    int first; // first row owned by the thread
+    int last;  // one past its last row
+} RowRange;
+
+// ints per dense row, padded so every row starts on a cache line
+static size_t dense_stride(int process_count) {
+    size_t per_line = CACHE_LINE / sizeof(int);
+    return (process_count + per_line - 1) / per_line * per_line;
+}
+
+/*
+ * touch_rows writes every row in range, which is what places its pages.
+ */
+static void *touch_rows(void *arg) {
+    RowRange *range = (RowRange*) arg;
+    for (int i=range->first; i<range->last; i++) {
+        int *row = range->matrix + (size_t) i * range->stride;
+        for (size_t j=0; j<range->stride; j++)
+            row[j] = -1;
+        row[i] = 0;
+    }
+    return NULL;
+}
+
+/*
+ * dense_alloc maps the n x stride matrix and has each thread's share of
+ * rows first .. first+count-1 initialized by that thread. The others are
+ * never touched, so they take address space but no memory.
+ */
+static int *dense_alloc(int process_count, int first, int count, size_t stride,
+                        int hugepages, int threads, size_t *mapped) {
+    size_t bytes = (size_t) process_count * stride * sizeof(int);
+    // rows nobody touches needn't be backed by swap
+    int noreserve = count < process_count ? MAP_NORESERVE : 0;
+    if (hugepages != HUGEPAGES_NONE)
+        bytes = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+
+    void *matrix = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugepages == HUGEPAGES_HUGETLB)
+        matrix = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | noreserve, -1, 0);
+#endif
+    if (matrix == MAP_FAILED) {
+        matrix = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | noreserve, -1, 0);
+        if (matrix == MAP_FAILED) {
+            printf("could not allocate states\n");
+            exit(1);
+        }
+#ifdef MADV_HUGEPAGE
+        // best effort, THP may be disabled system wide
+        if (hugepages != HUGEPAGES_NONE)
+            madvise(matrix, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    *mapped = bytes;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > count)
+        threads = count > 0 ? count : 1;
+
+    RowRange ranges[threads];
+    pthread_t workers[threads];
+    char started[threads];
+    for (int t=0; t<threads; t++) {
+        ranges[t].matrix = (int*) matrix;
+        ranges[t].stride = stride;
+        ranges[t].first = first + (int) ((long) count * t / threads);
+        ranges[t].last = first + (int) ((long) count * (t+1) / threads);
+    }
+
+    // thread 0's range is touched by the caller itself
+    for (int t=1; t<threads; t++) {
+        started[t] = pthread_create(&workers[t], NULL, touch_rows, &ranges[t]) == 0;
+        if (!started[t])
+            touch_rows(&ranges[t]);
+    }
+    touch_rows(&ranges[0]);
+    for (int t=1; t<threads; t++) {
+        if (started[t])
+            pthread_join(workers[t], NULL);
+    }
+    return (int*) matrix;
+}
+
+static void *alloc_or_die(size_t bytes) {
+    void *ptr = malloc(bytes);
+    if (ptr == NULL && bytes > 0) {
+        printf("could not allocate states\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void blocks_init(StateStore *store);
+
+StateStore *states_new(int process_count, int backend, int hugepages, int threads,
+                       int log_len, StateObserver observe) {
+    return states_new_rows(process_count, 0, process_count, backend, hugepages,
+                           threads, log_len, observe);
+}
+
+StateStore *states_new_rows(int process_count, int first, int count, int backend, int hugepages,
+                            int threads, int log_len, StateObserver observe) {
+    StateStore *store = (StateStore*) alloc_or_die(sizeof(StateStore));
+    memset(store, 0, sizeof(StateStore));
+    store->backend = backend;
+    store->process_count = process_count;
+    store->first_row = first;
+    store->row_count = count;
+    store->observe = observe;
+#ifdef STATES_AVX2
+    store->simd = __builtin_cpu_supports("avx2") ? STATES_SIMD_AVX2 : STATES_SIMD_NONE;
+#else
+    store->simd = STATES_SIMD_NONE;
+#endif
+
+    store->log_len = log_len > 0 ? log_len : 0;
+    if (store->log_len) {
+        // a tester goes through about one testee per cluster each round
+        int slots = 2;
+        while ((1 << (slots - 2)) < process_count && slots < 64)
+            slots++;
+        store->seen_slots = slots;
+        store->log = (int*) alloc_or_die(sizeof(int)*process_count*store->log_len);
+        store->versions = (uint32_t*) calloc(process_count, sizeof(uint32_t));
+        store->seen = (SeenVersion*) alloc_or_die(sizeof(SeenVersion)*process_count*slots);
+        store->seen_next = (unsigned char*) calloc(process_count, sizeof(unsigned char));
+        if (store->versions == NULL || store->seen_next == NULL) {
+            printf("could not allocate states\n");
+            exit(1);
+        }
+        for (size_t i=0; i<(size_t) process_count*slots; i++)
+            store->seen[i].testee = -1;
+    }
+
+    if (backend == STORE_DENSE) {
+        store->stride = dense_stride(process_count);
+        store->matrix = dense_alloc(process_count, first, count, store->stride, hugepages,
+                                    threads, &store->mapped);
+        return store;
+    }
+    if (backend == STORE_BLOCKS) {
+        blocks_init(store);
+        return store;
+    }
+
+    // nobody knows anybody else yet: baseline is -1, own entries are
+    // exceptions. Rows not held stay empty and are never read.
+    store->base = (int*) alloc_or_die(sizeof(int)*process_count);
+    store->rows = (SparseRow*) calloc(process_count, sizeof(SparseRow));
+    if (store->rows == NULL) {
+        printf("could not allocate states\n");
+        exit(1);
+    }
+    for (int i=0; i<process_count; i++)
+        store->base[i] = -1;
+    for (int i=first; i<first+count; i++) {
+        store->rows[i].len = store->rows[i].cap = 1;
+        store->rows[i].entries = (StateEntry*) alloc_or_die(sizeof(StateEntry));
+        store->rows[i].entries[0].t = i;
+        store->rows[i].entries[0].v = 0;
+    }
+    store->exceptions = count;
+    return store;
+}
+
+/*
+ * find_entry binary searches row for target t. Return its position, or
+ * the position it would be inserted at if absent.
+ */
+static int find_entry(const SparseRow *row, int t) {
+    int lo = 0, hi = row->len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->entries[mid].t < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void row_reserve(SparseRow *row, int cap) {
+    if (row->cap >= cap)
+        return;
+    row->cap = row->cap * 2 > cap ? row->cap * 2 : cap;
+    row->entries = (StateEntry*) realloc(row->entries, sizeof(StateEntry)*row->cap);
+    if (row->entries == NULL) {
+        printf("could not allocate states\n");
+        exit(1);
+    }
+}
+
+// give memory back once a row drops below a quarter of its capacity
+static void row_shrink(SparseRow *row) {
+    if (row->cap <= 4 || row->len >= row->cap / 4)
+        return;
+    StateEntry *entries = (StateEntry*) realloc(row->entries, sizeof(StateEntry)*(row->cap / 2));
+    if (entries != NULL) {
+        row->entries = entries;
+        row->cap /= 2;
+    }
+}
+
+/*
+ * row_put makes process p hold v for t in the sparse store, keeping an
+ * exception only when v differs from the baseline.
+ */
+static void row_put(StateStore *store, int p, int t, int v) {
+    SparseRow *row = &store->rows[p];
+    int pos = find_entry(row, t);
+    int found = pos < row->len && row->entries[pos].t == t;
+
+    if (v == store->base[t]) {
+        if (found) {
+            memmove(&row->entries[pos], &row->entries[pos+1],
+                    sizeof(StateEntry)*(row->len - pos - 1));
+            row->len--;
+            store->exceptions--;
+            row_shrink(row);
+        }
+        return;
+    }
+
+    if (!found) {
+        row_reserve(row, row->len + 1);
+        memmove(&row->entries[pos+1], &row->entries[pos],
+                sizeof(StateEntry)*(row->len - pos));
+        row->entries[pos].t = t;
+        row->len++;
+        store->exceptions++;
+    }
+    row->entries[pos].v = v;
+}
+
+/*
+ * block_hash mixes a block's entries into 32 bits.
+ */
+static uint32_t block_hash(const int *v) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int k=0; k<STATES_BLOCK; k++)
+        h = (h ^ (uint32_t) v[k]) * 0xff51afd7ed558ccdULL;
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+static StateBlock *block_new(StateStore *store) {
+    StateBlock *block = store->spare;
+    if (block)
+        store->spare = block->next;
+    else
+        block = (StateBlock*) alloc_or_die(sizeof(StateBlock));
+    block->refs = 1;
+    block->interned = 0;
+    store->block_count++;
+    return block;
+}
+
+static void table_unlink(StateStore *store, StateBlock *block) {
+    StateBlock **link = &store->table[block->hash & (store->table_size - 1)];
+    while (*link != block)
+        link = &(*link)->next;
+    *link = block->next;
+    block->interned = 0;
+}
+
+// drop a reference to block, keeping it as spare once unused
+static void block_release(StateStore *store, StateBlock *block) {
+    if (--block->refs > 0)
+        return;
+    if (block->interned)
+        table_unlink(store, block);
+    block->next = store->spare;
+    store->spare = block;
+    store->block_count--;
+}
+
+static void table_grow(StateStore *store) {
+    size_t size = store->table_size ? 2 * store->table_size : 1024;
+    StateBlock **table = (StateBlock**) calloc(size, sizeof(StateBlock*));
+    if (table == NULL) {
+        printf("could not allocate states\n");
+        exit(1);
+    }
+    for (size_t i=0; i<store->table_size; i++) {
+        StateBlock *block = store->table[i];
+        while (block) {
+            StateBlock *next = block->next;
+            block->next = table[block->hash & (size - 1)];
+            table[block->hash & (size - 1)] = block;
+            block = next;
+        }
+    }
+    free(store->table);
+    store->table = table;
+    store->table_size = size;
+}
+
+/*
+ * block_intern replaces the block at *slot, which nothing else points to,
+ * with the table's block holding the same entries if there's one, or
+ * enters it in the table.
+ */
+static void block_intern(StateStore *store, StateBlock **slot) {
+    StateBlock *block = *slot;
+    block->hash = block_hash(block->v);
+    StateBlock *same = store->table[block->hash & (store->table_size - 1)];
+    for (; same; same = same->next) {
+        if (same->hash == block->hash && memcmp(same->v, block->v, sizeof(block->v)) == 0)
+            break;
+    }
+    if (same) {
+        same->refs++;
+        block_release(store, block);
+        *slot = same;
+        return;
+    }
+
+    if (store->block_count > store->table_size)
+        table_grow(store);
+    StateBlock **chain = &store->table[block->hash & (store->table_size - 1)];
+    block->next = *chain;
+    *chain = block;
+    block->interned = 1;
+}
+
+/*
+ * block_writable makes the block at *slot private to it before a write:
+ * copied if shared, out of the table otherwise. Intern it again after.
+ */
+static StateBlock *block_writable(StateStore *store, StateBlock **slot) {
+    StateBlock *block = *slot;
+    if (block->refs > 1) {
+        StateBlock *copy = block_new(store);
+        memcpy(copy->v, block->v, sizeof(block->v));
+        block->refs--;
+        *slot = copy;
+        return copy;
+    }
+    if (block->interned)
+        table_unlink(store, block);
+    return block;
+}
+
+/*
+ * blocks_init lays out the initial vectors: every process shares the
+ * all unknown block but for the one holding its own entry.
+ */
+static void blocks_init(StateStore *store) {
+    int n = store->process_count;
+    store->row_blocks = (n + STATES_BLOCK - 1) / STATES_BLOCK;
+    store->blocks = (StateBlock**) alloc_or_die(sizeof(StateBlock*) * n * (size_t) store->row_blocks);
+    table_grow(store);
+
+    StateBlock *unknown = block_new(store);
+    for (int k=0; k<STATES_BLOCK; k++)
+        unknown->v[k] = -1;
+    block_intern(store, &unknown);
+    for (int p=0; p<n; p++) {
+        StateBlock **row = store->blocks + (size_t) p * store->row_blocks;
+        for (int b=0; b<store->row_blocks; b++) {
+            row[b] = unknown;
+            unknown->refs++;
+        }
+        block_writable(store, &row[p / STATES_BLOCK])->v[p % STATES_BLOCK] = 0;
+        block_intern(store, &row[p / STATES_BLOCK]);
+    }
+    block_release(store, unknown);
+}
+
+// append entry t to process p's change log
+static inline void log_change(StateStore *store, int p, int t) {
+    if (store->log_len) {
+        uint32_t v = store->versions[p]++;
+        store->log[(size_t) p * store->log_len + v % store->log_len] = t;
+    }
+}
+
+int states_sparse_get(const StateStore *store, int p, int t) {
+    const SparseRow *row = &store->rows[p];
+    int pos = find_entry(row, t);
+    if (pos < row->len && row->entries[pos].t == t)
+        return row->entries[pos].v;
+    return store->base[t];
+}
+
+void states_set(StateStore *store, int p, int t, int v) {
+    int old = states_get(store, p, t);
+    if (old == v)
+        return;
+
+    if (store->backend == STORE_DENSE)
+        store->matrix[(size_t) p * store->stride + t] = v;
+    else if (store->backend == STORE_BLOCKS) {
+        StateBlock **slot = &store->blocks[(size_t) p * store->row_blocks + t / STATES_BLOCK];
+        block_writable(store, slot)->v[t % STATES_BLOCK] = v;
+        block_intern(store, slot);
+    }
+    else
+        row_put(store, p, t, v);
+    log_change(store, p, t);
+    if (store->observe)
+        store->observe(p, t, old, v);
+}
+
+/*
+ * sparse_merge walks the union of both exception lists: entries absent
+ * from both hold the baseline on either side and can't change, so the
+ * merge costs O(tester exceptions + testee exceptions).
+ */
+static int sparse_merge(StateStore *store, int tester, int testee) {
+    SparseRow *ours = &store->rows[tester];
+    SparseRow *theirs = &store->rows[testee];
+    int need = ours->len + theirs->len;
+    if (store->scratch_cap < need) {
+        store->scratch_cap = need * 2;
+        free(store->scratch);
+        store->scratch = (StateEntry*) alloc_or_die(sizeof(StateEntry)*store->scratch_cap);
+    }
+
+    StateEntry *out = store->scratch;
+    int len = 0, changed = 0;
+    int a = 0, b = 0;
+    while (a < ours->len || b < theirs->len) {
+        int t, mine, other;
+        if (b >= theirs->len || (a < ours->len && ours->entries[a].t < theirs->entries[b].t)) {
+            t = ours->entries[a].t;
+            mine = ours->entries[a++].v;
+            other = store->base[t];
+        }
+        else if (a >= ours->len || theirs->entries[b].t < ours->entries[a].t) {
+            t = theirs->entries[b].t;
+            mine = store->base[t];
+            other = theirs->entries[b++].v;
+        }
+        else {
+            t = ours->entries[a].t;
+            mine = ours->entries[a++].v;
+            other = theirs->entries[b++].v;
+        }
+
+        int v = mine;
+        if (t != tester && other > mine) {
+            v = other;
+            changed++;
+            log_change(store, tester, t);
+            if (store->observe)
+                store->observe(tester, t, mine, other);
+        }
+        if (v != store->base[t]) {
+            out[len].t = t;
+            out[len++].v = v;
+        }
+    }
+
+    store->exceptions += len - ours->len;
+    row_reserve(ours, len);
+    memcpy(ours->entries, out, sizeof(StateEntry)*len);
+    ours->len = len;
+    row_shrink(ours);
+    return changed;
+}
+
+/*
+ * blocks_merge goes block by block, skipping those both vectors share,
+ * and only copies a tester's block when the testee's has news for it.
+ */
+static int blocks_merge(StateStore *store, int tester, int testee) {
+    StateBlock **ours = store->blocks + (size_t) tester * store->row_blocks;
+    StateBlock **theirs = store->blocks + (size_t) testee * store->row_blocks;
+    int changed = 0;
+    for (int b=0; b < store->row_blocks; b++) {
+        if (ours[b] == theirs[b]) {
+            store->shared_skips++;
+            continue;
+        }
+
+        int first = b * STATES_BLOCK;
+        int last = first + STATES_BLOCK < store->process_count ? STATES_BLOCK : store->process_count - first;
+        int *mine = NULL;
+        for (int k=0; k<last; k++) {
+            int old = ours[b]->v[k];
+            int other = theirs[b]->v[k];
+            if (first + k == tester || other <= old)
+                continue;
+            if (mine == NULL)
+                mine = block_writable(store, &ours[b])->v;
+            mine[k] = other;
+            changed++;
+            log_change(store, tester, first + k);
+            if (store->observe)
+                store->observe(tester, first + k, old, other);
+        }
+        if (mine)
+            block_intern(store, &ours[b]);
+    }
+    return changed;
+}
+
+/*
+ * seen_slot returns where tester keeps testee's last merged version,
+ * evicting another testee round robin if it isn't remembered. `found`
+ * tells whether the slot already held testee.
+ */
+static SeenVersion *seen_slot(StateStore *store, int tester, int testee, int *found) {
+    SeenVersion *slots = store->seen + (size_t) tester * store->seen_slots;
+    for (int i=0; i<store->seen_slots; i++) {
+        if (slots[i].testee == testee) {
+            *found = 1;
+            return &slots[i];
+        }
+    }
+
+    *found = 0;
+    SeenVersion *slot = &slots[store->seen_next[tester]];
+    store->seen_next[tester] = (store->seen_next[tester] + 1) % store->seen_slots;
+    slot->testee = testee;
+    return slot;
+}
+
+/*
+ * delta_merge replays testee's changes logged after `since` on tester.
+ */
+static int delta_merge(StateStore *store, int tester, int testee, uint32_t since) {
+    int *log = store->log + (size_t) testee * store->log_len;
+    int changed = 0;
+    for (uint32_t v=since; v != store->versions[testee]; v++) {
+        int t = log[v % store->log_len];
+        if (t == tester)
+            continue;
+
+        int theirs = states_get(store, testee, t);
+        if (theirs > states_get(store, tester, t)) {
+            states_set(store, tester, t, theirs);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+int states_merge(StateStore *store, int tester, int testee) {
+    if (store->log_len) {
+        int found;
+        SeenVersion *seen = seen_slot(store, tester, testee, &found);
+        uint32_t since = seen->version;
+        seen->version = store->versions[testee];
+        if (found && store->versions[testee] - since <= (uint32_t) store->log_len) {
+            store->delta_merges++;
+            return delta_merge(store, tester, testee, since);
+        }
+        store->full_merges++;
+    }
+
+    if (store->backend == STORE_SPARSE)
+        return sparse_merge(store, tester, testee);
+    if (store->backend == STORE_BLOCKS)
+        return blocks_merge(store, tester, testee);
+
+    int *ours = store->matrix + (size_t) tester * store->stride;
+    int *theirs = store->matrix + (size_t) testee * store->stride;
+    int changed = 0;
+    for (int i=0; i < store->process_count; i++) {
+        if (i == tester) continue;
+
+        if (theirs[i] > ours[i]) {
+            int old = ours[i];
+            ours[i] = theirs[i];
+            changed++;
+            log_change(store, tester, i);
+            if (store->observe)
+                store->observe(tester, i, old, theirs[i]);
+        }
+    }
+    return changed;
+}
+
+void states_row(const StateStore *store, int p, int *row) {
+    if (store->backend == STORE_DENSE) {
+        memcpy(row, store->matrix + (size_t) p * store->stride, sizeof(int)*store->process_count);
+        return;
+    }
+    for (int t=0; t < store->process_count; t++)
+        row[t] = states_get(store, p, t);
+}
+
+int states_merge_row(StateStore *store, int tester, const int *row) {
+    int changed = 0;
+    for (int t=0; t < store->process_count; t++) {
+        if (t != tester && row[t] > states_get(store, tester, t)) {
+            states_set(store, tester, t, row[t]);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+void states_rebase(StateStore *store, int t, int v) {
+    if (store->backend != STORE_SPARSE || store->base[t] == v)
+        return;
+
+    // logical values don't change: exceptions equal to v become implicit,
+    // while whoever held the old baseline now needs it spelled out
+    int old = store->base[t];
+    for (int p=0; p<store->process_count; p++) {
+        SparseRow *row = &store->rows[p];
+        int pos = find_entry(row, t);
+        if (pos < row->len && row->entries[pos].t == t) {
+            if (row->entries[pos].v != v)
+                continue;
+            memmove(&row->entries[pos], &row->entries[pos+1],
+                    sizeof(StateEntry)*(row->len - pos - 1));
+            row->len--;
+            store->exceptions--;
+            row_shrink(row);
+        }
+        else {
+            row_reserve(row, row->len + 1);
+            memmove(&row->entries[pos+1], &row->entries[pos],
+                    sizeof(StateEntry)*(row->len - pos));
+            row->entries[pos].t = t;
+            row->entries[pos].v = old;
+            row->len++;
+            store->exceptions++;
+        }
+    }
+    store->base[t] = v;
+}
+
+size_t states_memory(const StateStore *store) {
+    size_t bytes = (size_t) store->process_count *
+        (store->log_len * sizeof(int) + sizeof(uint32_t) + 1 + store->seen_slots * sizeof(SeenVersion));
+    // the rows in use, not the huge page rounded mapping, nor other
+    // partitions' rows
+    if (store->backend == STORE_DENSE)
+        return bytes + (size_t) store->row_count * store->stride * sizeof(int);
+    if (store->backend == STORE_BLOCKS)
+        return bytes + sizeof(StateBlock*) * ((size_t) store->process_count * store->row_blocks + store->table_size)
+            + sizeof(StateBlock) * store->block_count;
+
+    bytes += sizeof(int)*store->process_count + sizeof(SparseRow)*store->process_count;
+    for (int p=0; p<store->process_count; p++)
+        bytes += sizeof(StateEntry)*store->rows[p].cap;
+    return bytes;
+}
+
+void states_free(StateStore *store) {
+    if (store->backend == STORE_DENSE)
+        munmap(store->matrix, store->mapped);
+    else if (store->backend == STORE_BLOCKS) {
+        // at rest every block is in the table
+        for (size_t i=0; i<store->table_size; i++) {
+            while (store->table[i]) {
+                StateBlock *next = store->table[i]->next;
+                free(store->table[i]);
+                store->table[i] = next;
+            }
+        }
+        while (store->spare) {
+            StateBlock *next = store->spare->next;
+            free(store->spare);
+            store->spare = next;
+        }
+        free(store->table);
+        free(store->blocks);
+    }
+    else {
+        for (int p=0; p<store->process_count; p++)
+            free(store->rows[p].entries);
+        free(store->rows);
+        free(store->base);
+        free(store->scratch);
+    }
+    free(store->log);
+    free(store->versions);
+    free(store->seen);
+    free(store->seen_next);
+    free(store);
+}
+
+#ifdef STATES_AVX2
+/*
+ * odd_mask_avx2 packs the low bit of count ints, a multiple of 8, into
+ * mask: shifted to the sign bit, movemask gathers 8 of them at a time.
+ */
+__attribute__((target("avx2")))
+static void odd_mask_avx2(const int *row, int count, uint64_t *mask) {
+    for (int k=0; k<count; k+=8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (row + k));
+        uint64_t bits = (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(v, 31)));
+        mask[k >> 6] |= bits << (k & 63);
+    }
+}
+#endif
+
+void states_odd_mask(const StateStore *store, int p, int first, int count, uint64_t *mask) {
+    memset(mask, 0, sizeof(uint64_t) * ((count + 63) / 64));
+
+    // processes past the last one don't exist, they can't be correct
+    int present = store->process_count - first;
+    if (present > count)
+        present = count;
+    if (present < 0)
+        present = 0;
+    for (int k=present; k<count; k++)
+        mask[k >> 6] |= (uint64_t) 1 << (k & 63);
+
+    int k = 0;
+    if (store->backend == STORE_DENSE) {
+        const int *row = store->matrix + (size_t) p * store->stride + first;
+#ifdef STATES_AVX2
+        if (store->simd == STATES_SIMD_AVX2) {
+            k = present & ~7;
+            odd_mask_avx2(row, k, mask);
+        }
+#endif
+        // -1, unknown, is odd too
+        for (; k<present; k++)
+            mask[k >> 6] |= (uint64_t) (row[k] & 1) << (k & 63);
+        return;
+    }
+
+    for (; k<present; k++)
+        mask[k >> 6] |= (uint64_t) (states_get(store, p, first + k) & 1) << (k & 63);
+}
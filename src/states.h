@@ -0,0 +1,188 @@
+/* Armazenamento de estados do simulador Vcube
+ * Funcionalidade: guarda o vetor de estados de cada processo, seja como
+ * uma matriz n x n densa ou como excecoes a um vetor base compartilhado.
+ */
+
+#ifndef STATES_H
+#define STATES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// huge page policies for the dense matrix
+#define HUGEPAGES_NONE 0
+#define HUGEPAGES_THP 1     // madvise transparent huge pages (default)
+#define HUGEPAGES_HUGETLB 2 // explicit hugetlbfs pages, falls back to THP
+
+// state store representations
+#define STORE_DENSE 0  // contiguous n x n matrix
+#define STORE_SPARSE 1 // per process exceptions to a shared baseline vector
+#define STORE_BLOCKS 2 // vectors of copy-on-write blocks, identical ones shared
+
+// entries per STORE_BLOCKS block
+#define STATES_BLOCK 64
+
+// default change log length, per process
+#define GOSSIP_LOG 32
+
+// vector instructions states_odd_mask may use
+#define STATES_SIMD_NONE 0
+#define STATES_SIMD_AVX2 1
+
+// called for every entry whose value changes: process p's view of t
+typedef void (*StateObserver)(int p, int t, int old, int new);
+
+typedef struct {
+    int t; // target process
+    int v; // timestamp p holds for t
+} StateEntry;
+
+// sorted exceptions of one process
+typedef struct {
+    int len;
+    int cap;
+    StateEntry *entries;
+} SparseRow;
+
+/*
+ * A block of STATES_BLOCK consecutive entries of one or more vectors.
+ * Blocks are hash-consed: at rest every block is in the store's table and
+ * vectors holding the same entries point to the same block, which is
+ * copied before any of them writes to it.
+ */
+typedef struct StateBlock {
+    struct StateBlock *next; // table chain, or spare list
+    uint32_t refs; // vector slots pointing to it
+    uint32_t hash;
+    int interned; // whether it's in the table
+    int v[STATES_BLOCK];
+} StateBlock;
+
+// last version of `testee`'s change log a tester has merged
+typedef struct {
+    int testee; // -1 for a free slot
+    uint32_t version;
+} SeenVersion;
+
+typedef struct {
+    int backend;
+    int process_count;
+    int first_row; // rows first_row .. first_row+row_count-1 are held
+    int row_count; // all of them unless the system is partitioned
+    StateObserver observe;
+    int simd; // STATES_SIMD_*, the best the CPU supports unless lowered
+
+    // STORE_DENSE: row i is process i's vector, padded to a cache line
+    int *matrix;
+    size_t stride;
+    size_t mapped; // bytes mapped for the matrix
+
+    // STORE_SPARSE: p holds base[t] for t unless rows[p] has an entry for t.
+    // Exceptions only go once correct processes agree on t (see
+    // states_rebase), so while a fresh system first diagnoses itself every
+    // row gathers about n of them: memory peaks at O(n^2), above dense's
+    // as entries are twice as large, and settles at O(n + faulty * n)
+    int *base;
+    SparseRow *rows;
+    StateEntry *scratch; // merge output buffer
+    int scratch_cap;
+    size_t exceptions; // entries over all rows
+
+    // STORE_BLOCKS: process p's vector is blocks[p*row_blocks ...], its
+    // entry t at v[t % STATES_BLOCK] of block t / STATES_BLOCK
+    StateBlock **blocks;
+    int row_blocks;
+    StateBlock **table; // hash-consing table, table_size chains
+    size_t table_size;
+    size_t block_count; // distinct blocks
+    StateBlock *spare; // released blocks
+    long shared_skips; // merge blocks skipped as both vectors share them
+
+    // delta gossip: process p's k-th change was to entry log[p*log_len + k % log_len],
+    // versions[p] counts its changes. log_len 0 disables it.
+    int log_len;
+    int *log;
+    uint32_t *versions;
+    int seen_slots; // testees remembered per tester
+    SeenVersion *seen;
+    unsigned char *seen_next; // slot each tester evicts next
+    long delta_merges; // merges served from the change log
+    long full_merges;
+} StateStore;
+
+/*
+ * states_new builds a store in which process i holds -1 for every other
+ * process and 0 for itself. Dense matrices are mmap'ed with the given huge
+ * page policy and their rows split in `threads` contiguous ranges, each
+ * first-touched by its own thread so pages land on the NUMA node of the
+ * thread that owns those rows. Every process keeps a log of its last
+ * `log_len` changes, 0 disables delta merges.
+ */
+StateStore *states_new(int process_count, int backend, int hugepages, int threads,
+                       int log_len, StateObserver observe);
+
+/*
+ * states_new_rows is states_new for a partition of the system, which only
+ * reads and writes the vectors of processes first .. first+count-1. The
+ * dense matrix keeps its n rows of address space but only those are
+ * touched, so only those take memory; sparse rows not held stay empty.
+ * STORE_BLOCKS always holds every row.
+ */
+StateStore *states_new_rows(int process_count, int first, int count, int backend, int hugepages,
+                            int threads, int log_len, StateObserver observe);
+
+int states_sparse_get(const StateStore *store, int p, int t);
+
+// timestamp process p holds for process t
+static inline int states_get(const StateStore *store, int p, int t) {
+    if (store->backend == STORE_DENSE)
+        return store->matrix[(size_t) p * store->stride + t];
+    if (store->backend == STORE_BLOCKS)
+        return store->blocks[(size_t) p * store->row_blocks + t / STATES_BLOCK]->v[t % STATES_BLOCK];
+    return states_sparse_get(store, p, t);
+}
+
+// set process p's view of t, notifying the observer on change
+void states_set(StateStore *store, int p, int t, int v);
+
+/*
+ * states_merge copies into `tester`'s vector every entry more up to date in
+ * `testee`'s, except the tester's own. Timestamps only grow, so when the
+ * tester merged from testee before and the testee's change log still
+ * covers that version, only the entries logged since are looked at.
+ * With STORE_BLOCKS, blocks both vectors share are skipped whole.
+ * Return the number of entries changed.
+ */
+int states_merge(StateStore *store, int tester, int testee);
+
+// copy process p's whole vector into row
+void states_row(const StateStore *store, int p, int *row);
+
+/*
+ * states_merge_row is states_merge from a vector held elsewhere, such as
+ * another partition's. Return the number of entries changed.
+ */
+int states_merge_row(StateStore *store, int tester, const int *row);
+
+/*
+ * states_rebase moves target t's baseline to v once correct processes
+ * agree on it, dropping the exceptions that now match and materializing
+ * the old baseline for processes that still hold it. No-op when dense.
+ */
+void states_rebase(StateStore *store, int t, int v);
+
+/*
+ * states_odd_mask sets bit k of mask, which holds (count + 63) / 64 words,
+ * when process p's entry for first + k is odd: faulty or unknown. Entries
+ * past the last process are set too. Dense rows are read 8 entries at a
+ * time with AVX2 when store->simd allows it.
+ */
+void states_odd_mask(const StateStore *store, int p, int first, int count, uint64_t *mask);
+
+// bytes currently used to hold states
+size_t states_memory(const StateStore *store);
+
+// release the store and everything it holds
+void states_free(StateStore *store);
+
+#endif
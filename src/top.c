@@ -0,0 +1,56 @@
+/* Monitor das metricas ao vivo do Vcube
+ * Funcionalidade: le a regiao publicada por `vcube -M arquivo` e imprime
+ * uma linha por amostra, sem parar nem atrasar a simulacao.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+static const char *state_names[] = {"pending", "agreed", "superseded"};
+
+static void print_sample(const MetricsData *d) {
+    printf("t %.1f/%.0f  %llu events %.0f/s  list %d  pool %d/%d (max %d)  "
+           "faulty %d/%d  disagreeing %d  pending %d  agreements %llu  "
+           "latency %.1f (max %.1f)\n",
+           d->sim_time, d->deadline, (unsigned long long) d->events, d->events_per_second,
+           d->event_list, d->pool_used, d->pool_size, d->pool_max,
+           d->faulty, d->process_count, d->disagreeing, d->pending,
+           (unsigned long long) d->agreements, d->last_latency, d->max_latency);
+    for (int i=0; i < d->event_count && i < METRICS_EVENTS; i++) {
+        const MetricsEvent *e = &d->recent[i];
+        printf("    %6.1f: process %d %s (timestamp %d)  %d/%d agree  %s\n",
+               e->injected, e->target, e->timestamp & 1 ? "failed" : "recovered",
+               e->timestamp, e->agree, e->needed, state_names[e->state]);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "vcube.metrics";
+    double interval = argc > 2 ? atof(argv[2]) : 1.0;
+    long samples = argc > 3 ? atol(argv[3]) : 0;
+    if (interval <= 0) {
+        puts("Usage: [metrics file=vcube.metrics] [interval seconds=1] [samples=0 (until done)]");
+        exit(1);
+    }
+
+    const MetricsRegion *region = metrics_attach(path);
+    if (region == NULL) {
+        printf("%s is not a metrics region\n", path);
+        exit(1);
+    }
+    printf("simulation %d\n", region->pid);
+
+    MetricsData data;
+    for (long i=0; samples == 0 || i < samples; i++) {
+        metrics_read(region, &data);
+        print_sample(&data);
+        if (data.done)
+            break;
+        usleep((useconds_t) (interval * 1e6));
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+/* Transporte entre particoes do simulador Vcube
+ * Funcionalidade: implementacao local, com um par de sockets Unix entre
+ * cada dois processos, e a troca de mensagens entre todos eles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "transport.h"
+#include "util.h"
+
+typedef struct {
+    int *fd; // socket to each rank, -1 for itself
+    pid_t *children; // rank 0 only
+} UnixTransport;
+
+// messages go as their 8 byte length followed by the payload
+static int unix_send(Transport *t, int peer, const void *buf, size_t len) {
+    UnixTransport *u = (UnixTransport*) t->impl;
+    uint64_t header = len;
+    if (write_all(u->fd[peer], &header, sizeof(header)) != 0 || write_all(u->fd[peer], buf, len) != 0)
+        return -1;
+    t->messages++;
+    t->bytes += (long) len;
+    return 0;
+}
+
+static void *unix_recv(Transport *t, int peer, size_t *len) {
+    UnixTransport *u = (UnixTransport*) t->impl;
+    uint64_t header;
+    if (read_all(u->fd[peer], &header, sizeof(header)) != 0)
+        return NULL;
+    // one spare byte so that empty messages aren't NULL
+    char *buf = (char*) malloc(header + 1);
+    if (buf == NULL || read_all(u->fd[peer], buf, header) != 0) {
+        free(buf);
+        return NULL;
+    }
+    *len = header;
+    return buf;
+}
+
+static void unix_close(Transport *t) {
+    UnixTransport *u = (UnixTransport*) t->impl;
+    for (int q=0; q<t->ranks; q++) {
+        if (u->fd[q] >= 0)
+            close(u->fd[q]);
+    }
+    if (u->children) {
+        for (int q=1; q<t->ranks; q++)
+            waitpid(u->children[q], NULL, 0);
+    }
+    free(u->fd);
+    free(u->children);
+    free(u);
+    free(t);
+}
+
+Transport *transport_unix_spawn(int ranks) {
+    // pair[i*ranks + j] is i's end of the socket pair between i and j
+    int *pair = (int*) malloc(sizeof(int)*ranks*ranks);
+    pid_t *children = (pid_t*) calloc(ranks, sizeof(pid_t));
+    if (pair == NULL || children == NULL) {
+        free(pair);
+        free(children);
+        return NULL;
+    }
+    for (int i=0; i<ranks*ranks; i++)
+        pair[i] = -1;
+    for (int i=0; i<ranks; i++) {
+        for (int j=i+1; j<ranks; j++) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+                goto fail;
+            pair[i*ranks + j] = sv[0];
+            pair[j*ranks + i] = sv[1];
+        }
+    }
+
+    int rank = 0;
+    for (int q=1; q<ranks && rank == 0; q++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            // the children started so far see their sockets close and fail
+            for (int r=1; r<q; r++)
+                waitpid(children[r], NULL, 0);
+            goto fail;
+        }
+        if (pid == 0)
+            rank = q;
+        else
+            children[q] = pid;
+    }
+
+    // keep this rank's ends only
+    Transport *t = (Transport*) calloc(1, sizeof(Transport));
+    UnixTransport *u = (UnixTransport*) calloc(1, sizeof(UnixTransport));
+    int *fd = (int*) malloc(sizeof(int)*ranks);
+    if (t == NULL || u == NULL || fd == NULL) {
+        fprintf(stderr, "rank %d could not allocate its transport\n", rank);
+        exit(1);
+    }
+    for (int i=0; i<ranks; i++) {
+        for (int j=0; j<ranks; j++) {
+            if (i == rank)
+                fd[j] = pair[i*ranks + j];
+            else if (pair[i*ranks + j] >= 0)
+                close(pair[i*ranks + j]);
+        }
+    }
+    free(pair);
+    if (rank != 0) {
+        free(children);
+        children = NULL;
+    }
+
+    u->fd = fd;
+    u->children = children;
+    t->ranks = ranks;
+    t->rank = rank;
+    t->impl = u;
+    t->send = unix_send;
+    t->recv = unix_recv;
+    t->close = unix_close;
+    return t;
+
+fail:
+    for (int i=0; i<ranks*ranks; i++) {
+        if (pair[i] >= 0)
+            close(pair[i]);
+    }
+    free(pair);
+    free(children);
+    return NULL;
+}
+
+/*
+ * Ranks go through their peers in increasing order, the lower rank of
+ * each pair sending first: a rank only ever waits on a pair whose lower
+ * rank is done with every pair before it, so somebody always progresses.
+ */
+int transport_exchange(Transport *t, void **out, const size_t *out_len, void **in, size_t *in_len) {
+    for (int q=0; q<t->ranks; q++) {
+        if (q == t->rank) {
+            in[q] = NULL;
+            in_len[q] = 0;
+            continue;
+        }
+        if (t->rank < q && t->send(t, q, out[q], out_len[q]) != 0)
+            return -1;
+        if ((in[q] = t->recv(t, q, &in_len[q])) == NULL)
+            return -1;
+        if (t->rank > q && t->send(t, q, out[q], out_len[q]) != 0)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+/* Transporte entre particoes do simulador Vcube
+ * Funcionalidade: troca de mensagens entre os processos do sistema
+ * operacional que simulam, cada um, um subcubo do Vcube.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+
+/*
+ * Transport connects `ranks` partitions, this one being `rank`. Messages
+ * between two ranks arrive whole and in order. Implementations fill in
+ * the functions and keep their own state in impl.
+ */
+typedef struct Transport {
+    int ranks;
+    int rank;
+    long messages; // sent
+    long bytes;    // payload sent
+    void *impl;
+    // send len bytes of buf to peer as one message, return 0 on success
+    int (*send)(struct Transport *t, int peer, const void *buf, size_t len);
+    // wait for peer's next message, return it malloc'ed with its length
+    // in *len, NULL on failure
+    void *(*recv)(struct Transport *t, int peer, size_t *len);
+    // release the transport, rank 0 also waits for the others to end
+    void (*close)(struct Transport *t);
+} Transport;
+
+/*
+ * transport_unix_spawn forks ranks - 1 processes, connected to each other
+ * and to the caller by Unix domain socket pairs. It returns in every one
+ * of them, rank 0 being the caller, or NULL in the caller if the sockets
+ * or processes couldn't be made. Flush stdio before calling it.
+ */
+Transport *transport_unix_spawn(int ranks);
+
+/*
+ * transport_exchange sends out[q] (out_len[q] bytes) to every other rank q
+ * and stores what q sent in in[q], malloc'ed, and in_len[q]. Every rank
+ * must call it, pairs of ranks talking in an order that can't deadlock
+ * whatever the message sizes. Return 0 on success.
+ */
+int transport_exchange(Transport *t, void **out, const size_t *out_len, void **in, size_t *in_len);
+
+#endif
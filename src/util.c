@@ -0,0 +1,48 @@
+/* Utilitarios do simulador Vcube
+ * Funcionalidade: funcoes de texto e de descritores de arquivo usadas
+ * por mais de um modulo.
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+
+char *trim(char *s) {
+    while (isspace((unsigned char) *s))
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char*) buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+int read_all(int fd, void *buf, size_t len) {
+    char *p = (char*) buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+/* Utilitarios do simulador Vcube
+ * Funcionalidade: funcoes de texto e de descritores de arquivo usadas
+ * por mais de um modulo.
+ */
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+
+// strip leading and trailing white space from s in place, return its start
+char *trim(char *s);
+
+// write len bytes of buf to fd, return 0 on success, -1 otherwise
+int write_all(int fd, const void *buf, size_t len);
+
+// read len bytes from fd into buf, return 0 on success, -1 when fewer
+// came before the end or on error
+int read_all(int fd, void *buf, size_t len);
+
+#endif
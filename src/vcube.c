@@ -7,73 +7,500 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "smpl.h"
+#include "states.h"
+#include "probes.h"
+#include "metrics.h"
+#include "walltime.h"
+#include "faultlog.h"
+#include "transport.h"
+#include "branch.h"
 #include "cisj.c"
 
 #define test 1
 #define fault 2
 #define recovery 3
+#define refill 4 // schedule the next window of the failure log
+#define exchange 5 // swap vectors with the other partitions
+#define branch 6 // fork the what-if variants off
 
 #define IS_EVEN(num) ((num % 2) == 0)
 
 #define IS_CORRECT(timestamp) ((timestamp % 2) == 0)
 #define IS_FAULTY(timestamp) (!IS_CORRECT(timestamp))
 
+// liveness bitmap addressing: 64 processes per word, 512 per cache line
+#define LIVE_WORD(id) ((id) >> 6)
+#define LIVE_MASK(id) (((uint64_t) 1) << ((id) & 63))
+#define CACHE_LINE 64
+
+// clusters counted separately by the hot-path counters
+#define MAX_CLUSTERS 32
+
+// test_cluster implementations
+#define KERNEL_SCAN 0   // scan cis(target, s) for every target
+#define KERNEL_SCALAR 1 // whole cluster at once from the states parity
+#define KERNEL_AVX2 2   // same, parity gathered with AVX2
+#define KERNEL_AUTO 3   // KERNEL_AVX2 if the CPU has it, else KERNEL_SCALAR
+
+// states printed after each test
+#define OUTPUT_FULL 0  // the tester's whole vector
+#define OUTPUT_DELTA 1 // entries changed by the test, with periodic full keyframes
+#define OUTPUT_NONE 2
+#define KEYFRAME 16
+
+// diagnosis algorithms, see Algorithm
+#define ALGORITHM_VCUBE 0
+#define ALGORITHM_RING 1 // Adaptive-DSD
+#define ALGORITHMS 2
+
+// smallest system compared with -c
+#define COMPARE_FROM 8
+
+// failure log records are scheduled at most this far ahead of the clock,
+// and at most this many at a time
+#define LOG_WINDOW 100.0
+#define LOG_BATCH 4096
+
+// -E stops once the mean diagnosis latency moved less than this fraction
+// over this many windows in a row
+#define STEADY_TOLERANCE 0.01
+#define STEADY_WINDOWS 5
+
+// events taken from smpl at once, see run_simm
+#define BATCH 1024
+
+// events between two live metrics publications
+#define METRICS_EVERY 1024
+
+#define TEST_PERIOD 10
+#define DEADLINE 40
+
+// scenario 3 mean up and down times
+#define MTBF 60.0
+#define MTTR 15.0
+
+/*
+ * ProcessTable keeps per-process fields in separate arrays, and all state
+ * vectors in a StateStore (see states.h), so the test hot path only walks
+ * the memory it reads.
+ */
 typedef struct {
-    int id; // process id, eg simulated entity (aka facility)
-    int *states; // processes state vector
+    StateStore *states; // processes state vectors
     // indicates if process missed a round while crashed
-    int has_missed_test; 
-} ProcessFacility;
+    char *has_missed_test;
+    int *facility; // smpl facility ids, NULL unless facility accounting is enabled
+} ProcessTable;
 
 typedef struct Args {
     int process_count;
     int scenario;
+    int facility_accounting; // back faults with smpl facilities and print report()
+    int stats_format; // SMPL_JSON or SMPL_CSV, 0 disables statistics output
+    float stats_period; // sample statistics every period units of time, 0 for end only
+    int store; // STORE_* representation of the states
+    int hugepages; // HUGEPAGES_* policy for the dense state matrix
+    int threads; // threads first-touching the dense state matrix
+    int gossip_log; // changes logged per process for delta merges, 0 disables them
+    int counters; // dump hot-path counters to stderr when the simulation ends
+    char *record_path; // record smpl operations and draws to this file
+    float deadline; // simulated time to run for
+    int fast_forward; // skip test rounds once diagnosis is quiescent
+    int kernel; // KERNEL_* used by test_cluster
+    int output; // OUTPUT_* for the states printed after each test
+    int keyframe; // every keyframe-th states line of a process is full in OUTPUT_DELTA
+    char *metrics_path; // publish live metrics to this file
+    int algorithm; // ALGORITHM_* diagnosing the system
+    int compare; // run every algorithm over growing systems and compare them
+    char *log_path; // take faults and recoveries from this failure log
+    int converge; // stop once diagnosis converged and nothing is left to inject
+    float steady_window; // stop once diagnosis latency is steady over such windows, 0 never
+    int partitions; // OS processes the system is split across, a power of two
+    char *variants_path; // fork these what-if variants off the run
+    float branch_at; // at this time, -1 once diagnosis converges
+    int jobs; // variants running at once, 0 for one per CPU
 } Args;
 
+// dense liveness bitmap: bit `id` is set while process `id` is correct
+static uint64_t *liveness;
+// when set, fault/recovery also request/release the process' smpl facility
+static int facility_accounting;
+// machine-readable smpl statistics written to stderr
+static int stats_format;
+static float stats_period;
+
+/*
+ * Oracle incrementally checks that correct processes agree on the
+ * timestamp of every other process. truth[t] is the timestamp that
+ * diagnosis must converge to for target t; holders[t] counts the processes
+ * (other than t) whose states entry for t equals truth[t] and agree[t]
+ * the correct ones among them.
+ */
+typedef struct Oracle {
+    int process_count;
+    int correct_count; // number of correct processes
+    int *truth;
+    int *holders;
+    int *agree;
+    char *agreed;      // whether agree[t] has reached the required count
+    double *since;     // injection time of the event pending on t, -1 if none
+    int *ready;        // targets that reached agreement since the last flush
+    char *queued;      // whether t is in ready
+    int ready_count;
+    int disagreeing;   // targets not in agreement
+    int violations;
+    int pending;       // targets with since >= 0
+    int off;           // partitioned: no partition sees every vector
+    long agreements;   // events that reached agreement
+    double latency_sum;
+    double last_latency;
+    double max_latency;
+    MetricsEvent recent[METRICS_EVENTS]; // last injected events, newest first
+    int recent_count;
+} Oracle;
+
+static Oracle oracle;
+
+// vcube side hot-path counters, smpl keeps its own (see counts())
+typedef struct Counters {
+    long cis_calls;
+    long tests[MAX_CLUSTERS + 1]; // tests performed per cluster, 0 when not clustered
+    long rounds; // test rounds performed
+    long merges; // update_states calls
+    long entries_changed; // states entries changed by update_states
+} Counters;
+
+static Counters counters;
+static int dump_counters;
+
+/*
+ * Quiescence watches test rounds once correct processes agree on every
+ * process. A round ends when every correct process has tested once; two
+ * consecutive rounds adding the same counts and changing no entry prove
+ * the rounds left before the next fault, recovery or the deadline would
+ * only repeat themselves, so they are skipped with advance() and their
+ * counts credited.
+ */
+typedef struct Quiescence {
+    int left; // tests left in the round being watched, 0 when idle
+    int rounds; // consecutive rounds known to repeat `round`
+    Counters start; // counters when the round started
+    long start_merges[2]; // states' delta and full merges then
+    Counters round; // what the last round added
+    long round_merges[2];
+    long skipped; // test rounds skipped
+} Quiescence;
+
+static Quiescence quiet;
+static int fast_forward;
+
+static int test_kernel;
+
+/*
+ * Output keeps track of what a tester's test round changed, so that
+ * OUTPUT_DELTA only prints those entries. A process' vector only changes
+ * while it tests, so that's all that changed since its previous line.
+ */
+typedef struct Output {
+    int mode;
+    int keyframe;
+    int tester; // process testing right now, -1 outside test rounds
+    int *changed; // entries of tester changed this round
+    int changed_count;
+    char *marked; // whether an entry is in changed
+    long *lines; // states lines printed per process
+} Output;
+
+static Output output = {OUTPUT_FULL, KEYFRAME, -1, NULL, 0, NULL, NULL};
+
+// live metrics region, NULL unless requested
+static MetricsRegion *metrics;
+// parity of a tester's states over one of its clusters, see cluster_mask
+static uint64_t *odd_mask;
+
+/*
+ * Algorithm is a diagnosis strategy run on top of the same engine,
+ * scenarios and oracle. test_round picks whom process `id` tests in a
+ * round, executing each test with test_target, which applies its result
+ * and has the tester learn from correct testees through merge.
+ */
+typedef struct Algorithm {
+    const char *name;
+    void (*test_round)(int id, ProcessTable *processes, int process_count);
+    int (*merge)(StateStore *states, int tester, int testee);
+} Algorithm;
+
+static const Algorithm *algorithm;
+
+/*
+ * FailureLog feeds a failure log into smpl a window at a time: a refill
+ * event schedules the records due before LOG_WINDOW past it and, at the
+ * last of them, the next refill. The event list holds at most LOG_BATCH
+ * records whatever the log's length.
+ */
+typedef struct FailureLog {
+    FaultLog *log; // NULL once read through
+    FaultRecord next; // first record not scheduled yet
+    long scheduled;
+    long redundant; // faults of faulty processes and recoveries of correct ones
+} FailureLog;
+
+static FailureLog failure_log;
+
+/*
+ * Termination ends a run before its deadline once there's nothing left to
+ * observe: with `converge`, when no fault, recovery, log refill or
+ * branch is left in the event list and correct processes agree on every
+ * process; with a steady state window, when the mean diagnosis latency of a stochastic
+ * workload stays within STEADY_TOLERANCE for STEADY_WINDOWS windows in a
+ * row, each of them adding agreements.
+ */
+typedef struct Termination {
+    int converge;
+    float window;
+    float window_end;
+    long window_agreements; // oracle.agreements when the window started
+    double mean; // mean latency at the end of the last window, -1 before
+    int steady; // windows in a row within tolerance
+} Termination;
+
+static Termination termination;
+
+/*
+ * Partition is this OS process' share of a system split across 2^b of
+ * them: partition r simulates the subcube of processes whose b high-order
+ * id bits are r and holds only their vectors. Faults and recoveries are
+ * replayed by every partition, so liveness is known everywhere. A test of
+ * a process in another partition applies its result at once, but the
+ * merge waits for the next exchange event, every test period, where
+ * partitions send each other the vectors asked for in one batched message
+ * per pair. So news crossing partitions are up to a period late, and a
+ * tester's responsibility in a cluster isn't revised on what they bring.
+ * The oracle needs every vector, so it's off and diagnosis is checked at
+ * the end instead, see partition_finish.
+ */
+typedef struct Partition {
+    Transport *transport; // NULL when the system isn't partitioned
+    int first; // first process owned
+    int count; // processes owned
+    int *merges; // tester, testee pairs waiting for the exchange
+    int merge_count;
+    int merge_cap;
+    long exchanges;
+    long remote_merges;
+} Partition;
+
+static Partition partition;
+
+/*
+ * Branching forks what-if variants off a run. The prefix is simulated
+ * once, up to the branch time or by default until correct processes
+ * first agree on every process. Then each variant goes on in a child
+ * process of its own, sharing the prefix' memory copy-on-write, with its
+ * own faults and recoveries on top of what the scenario had scheduled.
+ * Children report a VariantResult, counted from the branch point, and
+ * the parent stops there to print them.
+ */
+typedef struct VariantResult {
+    int done; // 0 when the child died before reporting
+    int pending; // events pending agreement at the end
+    int violations;
+    int disagreeing; // targets not in agreement at the end
+    long agreements;
+    long tests;
+    double mean_latency;
+    double max_latency;
+    double end; // time the variant stopped at
+} VariantResult;
+
+typedef struct Branching {
+    Variant *variants; // NULL unless branching
+    int count;
+    int jobs;
+    float at; // branch time, -1 to branch once diagnosis converges
+    int ahead; // the branch point is still to come
+    int variant; // variant this process runs, -1 if none
+} Branching;
 
-void test_cluster(int id, int s, ProcessFacility *processes, int process_count);
-void vcube_test(int id, ProcessFacility *processes, int process_count);
+static Branching branching = {NULL, 0, 0, -1, 0, -1};
+
+// whether process `id` belongs to this partition
+static int is_local(int id) {
+    return id >= partition.first && id < partition.first + partition.count;
+}
+
+
+void schedule_scenario_0(int process_count);
+void schedule_scenario_1();
+void schedule_scenario_2(int process_count);
+void schedule_scenario_3(int process_count, float deadline);
+void schedule_failure_log(int process_count, char *path);
+void refill_failure_log(int process_count);
+void test_cluster(int id, int s, ProcessTable *processes, int process_count);
+void vcube_test(int id, ProcessTable *processes, int process_count);
+void ring_test(int id, ProcessTable *processes, int process_count);
 int next_timestamp(int timestamp, int is_correct);
-void update_states(int process_count, int tester_id, int *tester_states, int *testee_states);
-int is_first_correct_process_in_cis(int tester, int target, int s, int *states);
+int update_states(StateStore *states, int tester_id, int testee_id);
+int is_first_correct_process_in_cis(int tester, int target, int s, StateStore *states);
+int responsible_clusters(StateStore *states, int tester, int s);
 Args parse_args(int argc, char *argv[]);
-ProcessFacility* initialize(int process_count);
-void run_simm(ProcessFacility *processes, int process_count, float test_period, float deadline);
-int is_process_correct(ProcessFacility *processes, int id);
+ProcessTable* initialize(Args *args);
+ProcessTable* simulate(Args *args);
+void finalize(ProcessTable *processes);
+void compare(Args *args);
+void run_simm(ProcessTable *processes, int process_count, float test_period, float deadline);
+int is_process_correct(ProcessTable *processes, int id);
+void set_process_correct(int id, int is_correct);
+void oracle_init(int process_count);
+void oracle_observe(int p, int t, int old, int new);
+void observe_states(int p, int t, int old, int new);
+void print_states(ProcessTable *processes, int id, int process_count);
+void oracle_event(ProcessTable *processes, int id, int is_correct);
+void oracle_flush(ProcessTable *processes);
+void oracle_finish();
+void oracle_free();
+void counters_dump(ProcessTable *processes);
+void metrics_update(long events, float deadline, int done);
+void quiescence_check(ProcessTable *processes, int event, int token, float test_period, float deadline);
+void termination_init(Args *args);
+int termination_check(const int *left_events, int left_count);
+void partition_start(int partitions);
+void partition_queue(int tester, int testee);
+void partition_exchange(ProcessTable *processes, int process_count);
+void partition_finish(ProcessTable *processes, int process_count);
+void branching_init(Args *args);
+int branch_off();
+void branch_result();
 
 
+static const Algorithm algorithms[ALGORITHMS] = {
+    {"vcube", vcube_test, update_states},
+    {"ring", ring_test, update_states},
+};
+
 int main(int argc, char *argv[]) {
     Args args = parse_args(argc, argv);
-    ProcessFacility *processes = initialize(args.process_count);
+    if (args.partitions > 1)
+        partition_start(args.partitions);
+    if (args.compare)
+        compare(&args);
+    else
+        simulate(&args);
+    if (partition.transport)
+        partition.transport->close(partition.transport);
+    return 0;
+}
 
-    switch (args.scenario) {
+/*
+ * simulate runs the scenario in args from start to deadline.
+ * Return the process table as the simulation left it.
+ */
+ProcessTable* simulate(Args *args) {
+    ProcessTable *processes = initialize(args);
+    dump_counters = args->counters;
+    stats_format = args->stats_format;
+    stats_period = args->stats_period;
+    fast_forward = args->fast_forward;
+    termination_init(args);
+
+    switch (args->log_path ? -1 : args->scenario) {
+        case -1:
+            schedule_failure_log(args->process_count, args->log_path);
+            break;
         case 0:
-            schedule_scenario_0(args.process_count);
+            schedule_scenario_0(args->process_count);
             break;
         case 1:
-            schedule_scenario_1(args.process_count);
+            schedule_scenario_1();
             break;
         case 2:
-            schedule_scenario_2(args.process_count);
+            schedule_scenario_2(args->process_count);
+            break;
+        case 3:
+            schedule_scenario_3(args->process_count, args->deadline);
             break;
         default:
-            printf("unkown scenario %d!", args.scenario);
+            printf("unkown scenario %d!", args->scenario);
             exit(1);
     }
+    if (partition.transport)
+        schedule(exchange, TEST_PERIOD, 0);
+    if (args->variants_path)
+        branching_init(args);
 
-    run_simm(processes, args.process_count, 10, 40);
+    run_simm(processes, args->process_count, TEST_PERIOD, args->deadline);
+    if (branching.variant >= 0)
+        branch_result();
+    return processes;
 }
 
-void schedule_scenario_0(int process_count) {
-    for(int i=process_count/2; i<process_count; i++)
-        schedule(test, 0.0, i);
+/*
+ * compare runs the scenario with every algorithm for 8, 16, ... processes
+ * up to the process count, and prints on stderr what each run cost: tests
+ * per test round, messages (a test is a request and a reply carrying the
+ * testee's states), states memory and diagnosis latency. The simulations'
+ * own output is discarded. Runs stop as with -e, so latencies cover every
+ * injected event; runs the deadline cut short first are marked, their
+ * latencies leaving out the events still pending.
+ */
+void compare(Args *args) {
+    int process_count = args->process_count;
+    int converge = args->converge;
+    int cut_short = 0;
+    args->converge = 1;
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "could not discard the simulations' output\n");
+        exit(1);
+    }
+
+    fprintf(stderr, "%-9s %9s %12s %14s %14s %10s %12s %12s %8s\n", "algorithm", "processes",
+            "tests/round", "messages", "states bytes", "agreements", "mean latency",
+            "max latency", "pending");
+    for (int n = COMPARE_FROM < process_count ? COMPARE_FROM : process_count; ; n *= 2) {
+        if (n > process_count)
+            n = process_count;
+        for (int a=0; a<ALGORITHMS; a++) {
+            args->process_count = n;
+            args->algorithm = a;
+            ProcessTable *processes = simulate(args);
+
+            long tests = 0;
+            for (int s=0; s <= MAX_CLUSTERS; s++)
+                tests += counters.tests[s];
+            fprintf(stderr, "%-9s %9d %12.2f %14ld %14zu %10ld %12.2f %12.2f %8d%s\n",
+                    algorithm->name, n, counters.rounds ? (double) tests / counters.rounds : 0.0,
+                    2 * tests, states_memory(processes->states), oracle.agreements,
+                    oracle.agreements ? oracle.latency_sum / oracle.agreements : 0.0,
+                    oracle.max_latency, oracle.pending, oracle.pending ? " *" : "");
+            cut_short |= oracle.pending > 0;
+            finalize(processes);
+        }
+        if (n == process_count)
+            break;
+    }
+    if (cut_short)
+        fprintf(stderr, "* the deadline cut the run short, raise it with -D\n");
+    args->process_count = process_count;
+    args->converge = converge;
 }
 
-void schedule_scenario_1(int process_count) {
-    for(int i=0; i<process_count; i++)
+/*
+ * schedule_tests has the processes from `from` on test from the start,
+ * those of this partition only.
+ */
+static void schedule_tests(int from) {
+    for(int i = from > partition.first ? from : partition.first; i < partition.first + partition.count; i++)
         schedule(test, 0.0, i);
+}
+
+void schedule_scenario_0(int process_count) {
+    schedule_tests(process_count/2);
+}
+
+void schedule_scenario_1() {
+    schedule_tests(0);
 
     // schedule process 2 to fail then crash every
     // 10 units of time
@@ -90,134 +517,573 @@ void schedule_scenario_2(int process_count) {
     for(int i=process_count/2; i<process_count; i++)
         schedule(fault, 0.0, i);
 
-    for(int i=0; i<process_count; i++)
-        schedule(test, 0.0, i);
+    schedule_tests(0);
+}
+
+void schedule_scenario_3(int process_count, float deadline) {
+    schedule_tests(0);
+
+    // every process alternates exponentially distributed
+    // up and down periods until the deadline
+    for(int i=0; i<process_count; i++) {
+        double t = expntl(MTBF);
+        while (t < deadline) {
+            schedule(fault, t, i);
+            t += expntl(MTTR);
+            if (t >= deadline)
+                break;
+            schedule(recovery, t, i);
+            t += expntl(MTBF);
+        }
+    }
 }
 
 
+/*
+ * read_failure_log moves failure_log.next to the log's next record.
+ * Return 0 when there are no more.
+ */
+static int read_failure_log() {
+    int result = faultlog_next(failure_log.log, &failure_log.next);
+    if (result == FAULTLOG_ERROR) {
+        printf("failure log %s\n", failure_log.log->error);
+        exit(1);
+    }
+    if (result == FAULTLOG_END) {
+        faultlog_close(failure_log.log);
+        failure_log.log = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * schedule_failure_log has every process test from the start and faults
+ * and recoveries come from the log at `path`, its first record at time 0.
+ */
+void schedule_failure_log(int process_count, char *path) {
+    schedule_tests(0);
+
+    failure_log.log = faultlog_open(path);
+    if (failure_log.log == NULL) {
+        printf("could not read failure log %s\n", path);
+        exit(1);
+    }
+    failure_log.scheduled = failure_log.redundant = 0;
+    if (read_failure_log())
+        refill_failure_log(process_count);
+}
+
+/*
+ * refill_failure_log schedules the log's records due within LOG_WINDOW,
+ * LOG_BATCH of them at most, and the refill for the following ones.
+ */
+void refill_failure_log(int process_count) {
+    double horizon = time() + LOG_WINDOW;
+    double last = time();
+    int count = 0;
+    // the record the refill was scheduled for goes in whatever the rounding
+    while (count < LOG_BATCH && (count == 0 || failure_log.next.time < horizon)) {
+        FaultRecord *rec = &failure_log.next;
+        if (rec->process >= process_count) {
+            printf("failure log record for process %d, past the last one\n", rec->process);
+            exit(1);
+        }
+        last = rec->time > time() ? rec->time : time();
+        schedule(rec->kind == FAULTLOG_FAULT ? fault : recovery, last - time(), rec->process);
+        failure_log.scheduled++;
+        count++;
+        if (!read_failure_log())
+            return;
+    }
+    // refill once the records scheduled have played out, or LOG_WINDOW
+    // ahead of the next one after a gap in the log
+    double at = failure_log.next.time - LOG_WINDOW > last ? failure_log.next.time - LOG_WINDOW : last;
+    schedule(refill, at > time() ? at - time() : 0.0, 0);
+}
+
 /*
  * run_simm acts as the simulator's event loop.
  * It sequentially consumes the events previously schedule in the smpl library and processes them accordingly.
+ * Events sharing a time, such as a whole test round, are taken from smpl in one batch.
  */
-void run_simm(ProcessFacility *processes, int process_count, float test_period, float deadline) {
-    printf("Starting vCube simmulation:\n");
-    printf("%d processes; test period = %.2f; deadline = %.2f\n", process_count, test_period, deadline);
-    printf("========================================================\n");
+void run_simm(ProcessTable *processes, int process_count, float test_period, float deadline) {
+    if (!partition.transport || partition.transport->rank == 0) {
+        printf("Starting vCube simmulation:\n");
+        printf("%d processes; test period = %.2f; deadline = %.2f\n", process_count, test_period, deadline);
+        printf("========================================================\n");
+    }
+    if (partition.transport)
+        printf("Partition %d of %d: processes %d to %d\n", partition.transport->rank,
+               partition.transport->ranks, partition.first, partition.first + partition.count - 1);
 
     int token; // signals the process being currently executed
     int event; // last emitted event
+    int stats_header = SMPL_HEADER; // csv column names go out with the first sample
+    float next_sample = stats_period;
+    long events = 0;
+    int batch_events[BATCH], batch_tokens[BATCH];
+    // advance() must find every test still pending in the event list,
+    // and periodic statistics sample it between single events. Batches
+    // keep the order of single causes since a fault only requests the
+    // process's facility while it is free, so release() never wakes anyone
+    int batch = fast_forward || (stats_format && stats_period > 0) ? 1 : BATCH;
+    int stop = 0;
 
-    while(time() < deadline) {
-        cause(&event, &token);
-        switch(event) {
-            case test: 
-                // break out of the switch as a crashed process cannot perform tests
-                if (!is_process_correct(processes, token)) {
-                    processes[token].has_missed_test = 1;
-                    break;
-                }
+    while(!stop && time() < deadline) {
+        int count = cause_batch(batch_events, batch_tokens, batch);
+        int b;
+        for (b=0; b<count && !stop; b++) {
+            // stop right after the first event past the deadline, as
+            // when events were caused one at a time
+            if (b > 0 && time() >= deadline)
+                break;
+            event = batch_events[b];
+            token = batch_tokens[b];
+            events++;
+            switch(event) {
+                case test: 
+                    // break out of the switch as a crashed process cannot perform tests
+                    if (!is_process_correct(processes, token)) {
+                        processes->has_missed_test[token] = 1;
+                        break;
+                    }
 
-                vcube_test(token, processes, process_count);
-                schedule(test, test_period, token);
+                    output.tester = token;
+                    counters.rounds++;
+                    algorithm->test_round(token, processes, process_count);
+                    output.tester = -1;
+                    schedule(test, test_period, token);
+                    print_states(processes, token, process_count);
+                    break;
+                case fault:
+                    // logs may report a crash twice
+                    if (!is_process_correct(processes, token)) {
+                        failure_log.redundant++;
+                        break;
+                    }
+                    PROBE1(vcube, fault, token);
+                    set_process_correct(token, 0);
+                    if (facility_accounting)
+                        request(processes->facility[token], token, 0);
+                    // partitions only report their own processes
+                    if (is_local(token))
+                        printf("%4.1f: Proccess %d failed!\n", time(), token);
+                    oracle_event(processes, token, 0);
+                    break;
+                case recovery:
+                    if (is_process_correct(processes, token)) {
+                        failure_log.redundant++;
+                        break;
+                    }
+                    PROBE1(vcube, recovery, token);
+                    set_process_correct(token, 1);
+                    if (facility_accounting)
+                        release(processes->facility[token], token);
+                    // if the process has missed a test, make it test
+                    if (processes->has_missed_test[token]) {
+                        processes->has_missed_test[token] = 0;
+                        schedule(test, 0.0, token); 
+                    }
+                    if (is_local(token))
+                        printf("%4.1f: Process %d recovered!\n", time(), token);
+                    oracle_event(processes, token, 1);
+                    break;
+                case refill:
+                    refill_failure_log(process_count);
+                    break;
+                case branch:
+                    // see below, once the event is accounted
+                    break;
+                case exchange:
+                    // partitions stop at different events past the
+                    // deadline, only those before it are sure to be shared
+                    if (time() >= deadline)
+                        break;
+                    partition_exchange(processes, process_count);
+                    schedule(exchange, test_period, 0);
+                    break;
+            }
+            oracle_flush(processes);
+            if (fast_forward)
+                quiescence_check(processes, event, token, test_period, deadline);
+            if (metrics && events % METRICS_EVERY == 0)
+                metrics_update(events, deadline, 0);
+            // the prefix runs up to the branch point whatever -e or -E say
+            if (branching.ahead && (event == branch || (branching.at < 0 && oracle.disagreeing == 0)))
+                stop = branch_off();
+            else if (!branching.ahead)
+                stop = termination_check(&batch_events[b+1], count - b - 1);
 
-                printf("%4.1f: Process %d state: ", time(), token);
-                for (int j = 0; j < process_count; j++) {
-                    printf("[%d]: %d, ", j, processes[token].states[j]);
-                }
-                printf("\n");
-                break;
-            case fault:
-                request(processes[token].id, token, 0);
-                printf("%4.1f: Proccess %d failed!\n", time(), token);
-                break;
-            case recovery:
-                release(processes[token].id, token);
-                // if the process has missed a test, make it test
-                if (processes[token].has_missed_test) {
-                    processes[token].has_missed_test = 0;
-                    schedule(test, 0.0, token); 
-                }
-                printf("%4.1f: Process %d recovered!\n", time(), token);
-                break;
+            if (stats_format && stats_period > 0 && time() >= next_sample) {
+                stats(stderr, stats_format | stats_header);
+                stats_header = 0;
+                while (next_sample <= time())
+                    next_sample += stats_period;
+            }
+        }
+        // events of the batch left unhandled go back to smpl, as if never caused
+        while (count > b) {
+            count--;
+            uncause(batch_events[count], batch_tokens[count]);
         }
     }
+
+    oracle_finish();
+    if (branching.ahead)
+        printf("%4.1f: Branch point not reached, no variant ran\n", time());
+    if (partition.transport)
+        partition_finish(processes, process_count);
+    if (failure_log.scheduled)
+        printf("%4.1f: Failure log: %ld records scheduled, %ld redundant ones ignored\n",
+               time(), failure_log.scheduled, failure_log.redundant);
+    if (metrics)
+        metrics_update(events, deadline, 1);
+    if (dump_counters)
+        counters_dump(processes);
+    record_end();
+    if (stats_format)
+        stats(stderr, stats_format | stats_header);
+    if (facility_accounting)
+        report();
 }
 
 
 /*
  * Parse command line arguments.
- * Expect a single integer argument representing the process count.
- * Return process count
+ * Expect an integer argument representing the process count,
+ * optionally followed by the scenario number and flags:
+ *   -u           keep smpl facility accounting and print its utilization report
+ *   -S json|csv  write smpl statistics to stderr when the simulation ends
+ *   -P period    also sample them every `period` units of simulated time
+ *   -m dense|sparse|blocks  states representation, dense by default
+ *   -H none|thp|hugetlb  huge page policy for the dense matrix, thp by default
+ *   -T threads   threads first-touching dense matrix rows
+ *   -g length    changes each process logs for delta merges, 0 always merges in full
+ *   -C           dump hot-path counters to stderr when the simulation ends
+ *   -R file      record smpl operations and random draws for smpl_replay
+ *   -D deadline  simulated time to run for, 40 by default
+ *   -f           skip test rounds while diagnosis is quiescent
+ *   -K scan|scalar|avx2  test_cluster kernel, avx2 when supported by default
+ *   -o full|delta|none  states printed after each test, full by default
+ *   -k interval  print the full vector every `interval` lines of a process with -o delta
+ *   -M file      publish live metrics to file, see vcube_top
+ *   -A vcube|ring  diagnosis algorithm, vcube by default
+ *   -c           compare the algorithms on growing systems instead, see compare
+ *   -L file      take faults and recoveries from a failure log, see faultlog.h,
+ *                every process testing from the start whatever the scenario
+ *   -e           stop once diagnosis converged and nothing is left to inject
+ *   -E window    stop once diagnosis latency is steady over windows of that length
+ *   -p count     split the system across `count` OS processes, see Partition
+ *   -B file      fork the what-if variants in file off the run, see branch.h
+ *   -F time      branch at that time, once diagnosis converges by default
+ *   -j jobs      variants running at once, one per CPU by default
+ * Return parsed arguments
  */
 Args parse_args(int argc, char *argv[]) {
     if (argc < 2) {
-        puts("Usage: [process count] [scenario=0]");
+        puts("Usage: [process count] [scenario=0] [-u] [-S json|csv] [-P period] "
+             "[-m dense|sparse|blocks] [-H none|thp|hugetlb] [-T threads] [-g length] [-C] [-R file] "
+             "[-D deadline] [-f] [-K scan|scalar|avx2] [-o full|delta|none] [-k interval] "
+             "[-M file] [-A vcube|ring] [-c] [-L failure log] [-e] [-E window] [-p partitions] "
+             "[-B variants] [-F time] [-j jobs]");
         exit(1);
     }
 
-    int n = atoi(argv[1]);
-    int scenario = 0;
-    if (argc == 3)
-        scenario = atoi(argv[2]);
-    Args args = {n, scenario};
+    Args args = {atoi(argv[1]), 0, 0, 0, 0, STORE_DENSE, HUGEPAGES_THP, 1, GOSSIP_LOG, 0, NULL,
+                 DEADLINE, 0, KERNEL_AUTO, OUTPUT_FULL, KEYFRAME, NULL, ALGORITHM_VCUBE, 0, NULL, 0, 0, 1,
+                 NULL, -1, 0};
+    for (int i=2; i<argc; i++) {
+        if (strcmp(argv[i], "-u") == 0)
+            args.facility_accounting = 1;
+        else if (strcmp(argv[i], "-S") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "json") == 0)
+                args.stats_format = SMPL_JSON;
+            else if (strcmp(argv[i], "csv") == 0)
+                args.stats_format = SMPL_CSV;
+            else {
+                printf("unknown statistics format %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-P") == 0 && i+1 < argc)
+            args.stats_period = atof(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "dense") == 0)
+                args.store = STORE_DENSE;
+            else if (strcmp(argv[i], "sparse") == 0)
+                args.store = STORE_SPARSE;
+            else if (strcmp(argv[i], "blocks") == 0)
+                args.store = STORE_BLOCKS;
+            else {
+                printf("unknown states representation %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-H") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "none") == 0)
+                args.hugepages = HUGEPAGES_NONE;
+            else if (strcmp(argv[i], "thp") == 0)
+                args.hugepages = HUGEPAGES_THP;
+            else if (strcmp(argv[i], "hugetlb") == 0)
+                args.hugepages = HUGEPAGES_HUGETLB;
+            else {
+                printf("unknown huge page policy %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-T") == 0 && i+1 < argc)
+            args.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-R") == 0 && i+1 < argc)
+            args.record_path = argv[++i];
+        else if (strcmp(argv[i], "-C") == 0)
+            args.counters = 1;
+        else if (strcmp(argv[i], "-g") == 0 && i+1 < argc)
+            args.gossip_log = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-D") == 0 && i+1 < argc)
+            args.deadline = atof(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0)
+            args.fast_forward = 1;
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "full") == 0)
+                args.output = OUTPUT_FULL;
+            else if (strcmp(argv[i], "delta") == 0)
+                args.output = OUTPUT_DELTA;
+            else if (strcmp(argv[i], "none") == 0)
+                args.output = OUTPUT_NONE;
+            else {
+                printf("unknown output mode %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0 && i+1 < argc)
+            args.keyframe = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-M") == 0 && i+1 < argc)
+            args.metrics_path = argv[++i];
+        else if (strcmp(argv[i], "-A") == 0 && i+1 < argc) {
+            i++;
+            args.algorithm = -1;
+            for (int a=0; a<ALGORITHMS; a++) {
+                if (strcmp(argv[i], algorithms[a].name) == 0)
+                    args.algorithm = a;
+            }
+            if (args.algorithm < 0) {
+                printf("unknown diagnosis algorithm %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+            args.compare = 1;
+        else if (strcmp(argv[i], "-L") == 0 && i+1 < argc)
+            args.log_path = argv[++i];
+        else if (strcmp(argv[i], "-e") == 0)
+            args.converge = 1;
+        else if (strcmp(argv[i], "-E") == 0 && i+1 < argc)
+            args.steady_window = atof(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+            args.partitions = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-B") == 0 && i+1 < argc)
+            args.variants_path = argv[++i];
+        else if (strcmp(argv[i], "-F") == 0 && i+1 < argc)
+            args.branch_at = atof(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+            args.jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-K") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "scan") == 0)
+                args.kernel = KERNEL_SCAN;
+            else if (strcmp(argv[i], "scalar") == 0)
+                args.kernel = KERNEL_SCALAR;
+            else if (strcmp(argv[i], "avx2") == 0)
+                args.kernel = KERNEL_AVX2;
+            else {
+                printf("unknown test kernel %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (argv[i][0] == '-') {
+            printf("unknown option %s\n", argv[i]);
+            exit(1);
+        }
+        else
+            args.scenario = atoi(argv[i]);
+    }
+    if (args.compare && (args.record_path || args.metrics_path)) {
+        printf("-c can't record or publish metrics\n");
+        exit(1);
+    }
+    // partitions split the cube into subcubes of equal size
+    int p = args.partitions;
+    if (p < 1 || (p & (p-1)) != 0 || args.process_count % p != 0) {
+        printf("partitions must be a power of two dividing the process count\n");
+        exit(1);
+    }
+    // all of these need the oracle or a single process
+    if (p > 1 && (args.compare || args.record_path || args.metrics_path || args.fast_forward
+                  || args.converge || args.steady_window > 0)) {
+        printf("-p can't be combined with -c, -R, -M, -f, -e or -E\n");
+        exit(1);
+    }
+    // a blocks store holds every process' row
+    if (p > 1 && args.store == STORE_BLOCKS) {
+        printf("-p needs -m dense or sparse\n");
+        exit(1);
+    }
+    // variants would share the recording, metrics and partitions
+    if (args.variants_path && (args.compare || args.record_path || args.metrics_path || p > 1)) {
+        printf("-B can't be combined with -c, -R, -M or -p\n");
+        exit(1);
+    }
+    if (args.variants_path && args.branch_at >= args.deadline) {
+        printf("the branch time must come before the deadline\n");
+        exit(1);
+    }
     return args;
 }
 
 
 /*
- * Initialize smpl library, build facilities and processes.
- * Return pointer to allocated array of processes
+ * Initialize smpl library, liveness bitmap and processes.
+ * smpl facilities are only built when facility accounting is requested,
+ * as liveness is otherwise tracked by the bitmap alone.
+ * Return pointer to the allocated process table
  */
-ProcessFacility* initialize(int process_count) {
+ProcessTable* initialize(Args *args) {
+    int process_count = args->process_count;
+    int with_facilities = args->facility_accounting;
 
     // smpl init
     smpl(0, "Simm. name");
+    if (args->record_path && record(args->record_path) != 0) {
+        printf("could not record to %s\n", args->record_path);
+        exit(1);
+    }
     reset();
     stream(1);
 
-    ProcessFacility *processes = (ProcessFacility*) malloc(sizeof(ProcessFacility)*process_count);
+    ProcessTable *processes = (ProcessTable*) malloc(sizeof(ProcessTable));
     if(processes == NULL) {
         printf("failed to allocate processes\n");
         exit(1);
     }
 
-    char fa_name[5]; // facility name
-    for(int i=0; i<process_count; i++) {
-        memset(fa_name, '\0', 5);
-        sprintf(fa_name, "%d", i);
-        processes[i].id = facility(fa_name, 1);
+    // round the bitmap up to whole cache lines, every process starts correct
+    size_t live_bytes = ((process_count + 511) / 512) * CACHE_LINE;
+    liveness = (uint64_t*) aligned_alloc(CACHE_LINE, live_bytes);
+    processes->has_missed_test = (char*) calloc(process_count, sizeof(char));
+    if (liveness == NULL || processes->has_missed_test == NULL) {
+        printf("failed to allocate processes\n");
+        exit(1);
+    }
+    memset(liveness, 0, live_bytes);
+    for (int i=0; i<process_count; i++)
+        liveness[LIVE_WORD(i)] |= LIVE_MASK(i);
+
+    // states are initialized to -1 for all processes other than self,
+    // a partition only holds its own processes' vectors
+    int ranks = partition.transport ? partition.transport->ranks : 1;
+    partition.count = process_count / ranks;
+    partition.first = partition.transport ? partition.transport->rank * partition.count : 0;
+    processes->states = states_new_rows(process_count, partition.first, partition.count, args->store,
+                                        args->hugepages, args->threads, args->gossip_log,
+                                        observe_states);
+
+    // the batch kernels read parity with AVX2 only when asked or by default
+    if (args->kernel == KERNEL_AVX2 && processes->states->simd != STATES_SIMD_AVX2) {
+        printf("AVX2 is not supported by this CPU\n");
+        exit(1);
+    }
+    if (args->kernel == KERNEL_SCALAR)
+        processes->states->simd = STATES_SIMD_NONE;
+    test_kernel = args->kernel == KERNEL_SCAN ? KERNEL_SCAN : KERNEL_SCALAR;
+    odd_mask = (uint64_t*) malloc(sizeof(uint64_t) * ((process_count + 63) / 64));
+    if (odd_mask == NULL) {
+        printf("failed to allocate processes\n");
+        exit(1);
+    }
+
+    if (args->metrics_path && (metrics = metrics_create(args->metrics_path)) == NULL) {
+        printf("could not publish metrics to %s\n", args->metrics_path);
+        exit(1);
+    }
 
-        int *states = (int*) malloc(sizeof(int)*process_count);
-        if (states == NULL) {
-            printf("could not allocate states\n");
+    output.mode = args->output;
+    output.keyframe = args->keyframe > 0 ? args->keyframe : 1;
+    if (output.mode == OUTPUT_DELTA) {
+        output.changed = (int*) malloc(sizeof(int)*process_count);
+        output.marked = (char*) calloc(process_count, sizeof(char));
+        output.lines = (long*) calloc(process_count, sizeof(long));
+        if (output.changed == NULL || output.marked == NULL || output.lines == NULL) {
+            printf("failed to allocate processes\n");
             exit(1);
         }
+    }
 
-        processes[i].states = states;
+    facility_accounting = with_facilities;
+    processes->facility = NULL;
+    if (with_facilities) {
+        processes->facility = (int*) malloc(sizeof(int)*process_count);
+        if (processes->facility == NULL) {
+            printf("failed to allocate facilities\n");
+            exit(1);
+        }
 
-        // initialize states to -1 for all processes other than self
-        for (int j =0; j<process_count; j++) {
-            processes[i].states[j] = j == i ? 0 : -1;
+        char fa_name[12]; // facility name
+        for(int i=0; i<process_count; i++) {
+            memset(fa_name, '\0', sizeof(fa_name));
+            sprintf(fa_name, "%d", i);
+            processes->facility[i] = facility(fa_name, 1);
         }
     }
+
+    algorithm = &algorithms[args->algorithm];
+    oracle_init(process_count);
+    oracle.off = partition.transport != NULL;
     return processes;
 }
 
+/*
+ * finalize frees what initialize allocated and clears the counters, so
+ * that another simulation can run in the same process.
+ */
+void finalize(ProcessTable *processes) {
+    states_free(processes->states);
+    free(processes->has_missed_test);
+    free(processes->facility);
+    free(processes);
+    free(liveness);
+    free(odd_mask);
+    free(output.changed);
+    free(output.marked);
+    free(output.lines);
+    output = (Output) {OUTPUT_FULL, KEYFRAME, -1, NULL, 0, NULL, NULL};
+    oracle_free();
+    if (failure_log.log)
+        faultlog_close(failure_log.log);
+    memset(&failure_log, 0, sizeof(failure_log));
+    memset(&counters, 0, sizeof(counters));
+    memset(&quiet, 0, sizeof(quiet));
+    free(partition.merges);
+    partition.merges = NULL;
+    partition.merge_count = partition.merge_cap = 0;
+}
+
 
 /*
  * update_states updates tester's states vector with
  * all information more up to date from testee.
+ * Return the number of entries changed.
  */
-void update_states(int process_count, int tester_id, int *tester_states, int *testee_states) {
-    for (int i=0; i < process_count; i++) {
-        if (i == tester_id) continue;
-
-        int ours = tester_states[i];
-        int theirs = testee_states[i];
-        if (theirs > ours) {
-            tester_states[i] = theirs;
-        }
-    }
+int update_states(StateStore *states, int tester_id, int testee_id) {
+    int changed = states_merge(states, tester_id, testee_id);
+    counters.merges++;
+    counters.entries_changed += changed;
+    PROBE3(vcube, merge, tester_id, testee_id, changed);
+    return changed;
 }
 
 
@@ -239,9 +1105,732 @@ int next_timestamp(int timestamp, int is_correct) {
 /*
  * Return 1 is process is up, 0 otherwise
  */
-int is_process_correct(ProcessFacility *processes, int id) {
-    // smpl status function returns 0 if the facility has been released
-    return status(processes[id].id) == 0;
+int is_process_correct(ProcessTable *processes, int id) {
+    return (liveness[LIVE_WORD(id)] & LIVE_MASK(id)) != 0;
+}
+
+/*
+ * set_process_correct flips process `id`'s bit in the liveness bitmap.
+ */
+void set_process_correct(int id, int is_correct) {
+    if (is_correct)
+        liveness[LIVE_WORD(id)] |= LIVE_MASK(id);
+    else
+        liveness[LIVE_WORD(id)] &= ~LIVE_MASK(id);
+}
+
+/*
+ * observe_states is notified of every states entry that changes: process
+ * `p`'s view of `t` going from `old` to `new`.
+ */
+void observe_states(int p, int t, int old, int new) {
+    oracle_observe(p, t, old, new);
+    if (output.changed && p == output.tester && !output.marked[t]) {
+        output.marked[t] = 1;
+        output.changed[output.changed_count++] = t;
+    }
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return *(const int*) a - *(const int*) b;
+}
+
+/*
+ * print_states prints process `id`'s vector after its test round, whole or
+ * as the entries the round changed in OUTPUT_DELTA. There, a process'
+ * first line and every keyframe-th after it are whole, so its vector at
+ * any time is its last whole line patched by the change lines since.
+ */
+void print_states(ProcessTable *processes, int id, int process_count) {
+    if (output.mode == OUTPUT_NONE)
+        return;
+
+    if (output.mode == OUTPUT_FULL || output.lines[id]++ % output.keyframe == 0) {
+        printf("%4.1f: Process %d state: ", time(), id);
+        for (int j = 0; j < process_count; j++) {
+            printf("[%d]: %d, ", j, states_get(processes->states, id, j));
+        }
+        printf("\n");
+    }
+    else if (output.changed_count) {
+        qsort(output.changed, output.changed_count, sizeof(int), compare_ids);
+        printf("%4.1f: Process %d changes: ", time(), id);
+        for (int i = 0; i < output.changed_count; i++) {
+            int j = output.changed[i];
+            printf("[%d]: %d, ", j, states_get(processes->states, id, j));
+        }
+        printf("\n");
+    }
+
+    if (output.changed) {
+        for (int i = 0; i < output.changed_count; i++)
+            output.marked[output.changed[i]] = 0;
+        output.changed_count = 0;
+    }
+}
+
+/*
+ * oracle_init starts the agreement oracle for a fresh system: every
+ * process is correct at timestamp 0 and nobody has diagnosed it yet,
+ * so initial diagnosis is pending for every target since time 0.
+ */
+void oracle_init(int process_count) {
+    oracle.process_count = process_count;
+    oracle.correct_count = process_count;
+    oracle.truth = (int*) calloc(process_count, sizeof(int));
+    oracle.holders = (int*) calloc(process_count, sizeof(int));
+    oracle.agree = (int*) calloc(process_count, sizeof(int));
+    oracle.agreed = (char*) calloc(process_count, sizeof(char));
+    oracle.since = (double*) malloc(sizeof(double)*process_count);
+    oracle.ready = (int*) malloc(sizeof(int)*process_count);
+    oracle.queued = (char*) calloc(process_count, sizeof(char));
+    if (oracle.truth == NULL || oracle.holders == NULL || oracle.agree == NULL
+            || oracle.agreed == NULL || oracle.since == NULL
+            || oracle.ready == NULL || oracle.queued == NULL) {
+        printf("could not allocate oracle\n");
+        exit(1);
+    }
+
+    oracle.disagreeing = 0;
+    oracle.violations = 0;
+    oracle.ready_count = 0;
+    oracle.pending = process_count;
+    oracle.agreements = 0;
+    oracle.latency_sum = oracle.last_latency = oracle.max_latency = 0;
+    oracle.recent_count = 0;
+    for (int t=0; t<process_count; t++) {
+        oracle.since[t] = 0.0;
+        // a single process trivially agrees with itself
+        oracle.agreed[t] = process_count == 1;
+        oracle.disagreeing += !oracle.agreed[t];
+    }
+}
+
+/*
+ * oracle_check compares target `t`'s counter against the number of correct
+ * processes required to hold its timestamp, and reports the instant in
+ * which agreement is reached for the event pending on `t`.
+ */
+static void oracle_check(int t) {
+    int needed = oracle.correct_count - ((liveness[LIVE_WORD(t)] & LIVE_MASK(t)) != 0);
+    int agreed = oracle.agree[t] >= needed;
+    if (agreed == oracle.agreed[t])
+        return;
+
+    oracle.agreed[t] = agreed;
+    if (!agreed) {
+        oracle.disagreeing++;
+        return;
+    }
+
+    oracle.disagreeing--;
+    if (!oracle.queued[t]) {
+        oracle.queued[t] = 1;
+        oracle.ready[oracle.ready_count++] = t;
+    }
+    if (oracle.since[t] >= 0) {
+        double latency = time() - oracle.since[t];
+        printf("%4.1f: Agreement on process %d at timestamp %d (latency %.1f)\n",
+               time(), t, oracle.truth[t], latency);
+        oracle.since[t] = -1;
+        oracle.pending--;
+        oracle.agreements++;
+        oracle.latency_sum += latency;
+        oracle.last_latency = latency;
+        if (latency > oracle.max_latency)
+            oracle.max_latency = latency;
+    }
+    if (oracle.disagreeing == 0)
+        printf("%4.1f: Global diagnosis agreement reached\n", time());
+}
+
+/*
+ * oracle_observe accounts process `p`'s states entry for `t` changing from
+ * `old` to `new`. It's O(1) and must be called for every states write.
+ * Timestamps never decrease and never go past the truth, any write
+ * breaking either rule is flagged as a violation.
+ */
+void oracle_observe(int p, int t, int old, int new) {
+    if (p == t || oracle.off)
+        return;
+
+    if (new < old || new > oracle.truth[t]) {
+        oracle.violations++;
+        printf("%4.1f: ORACLE VIOLATION: process %d moved process %d from timestamp %d to %d (truth %d)\n",
+               time(), p, t, old, new, oracle.truth[t]);
+    }
+
+    int delta = (new == oracle.truth[t]) - (old == oracle.truth[t]);
+    if (delta == 0)
+        return;
+    oracle.holders[t] += delta;
+    if (liveness[LIVE_WORD(p)] & LIVE_MASK(p)) {
+        oracle.agree[t] += delta;
+        oracle_check(t);
+    }
+}
+
+/*
+ * oracle_event accounts process `id` failing or recovering, called after
+ * the liveness bitmap is updated. The target's truth moves to the next
+ * timestamp, unless nobody ever learned of the current one: an event that
+ * went undetected is masked by the new one, so the truth falls back to the
+ * timestamp processes still hold. O(n) per injected event.
+ */
+void oracle_event(ProcessTable *processes, int id, int is_correct) {
+    int n = oracle.process_count;
+    StateStore *states = processes->states;
+    if (oracle.off)
+        return;
+
+    // `id` joins or leaves the set of processes whose knowledge counts
+    oracle.correct_count += is_correct ? 1 : -1;
+    for (int t=0; t<n; t++) {
+        if (t != id && states_get(states, id, t) == oracle.truth[t])
+            oracle.agree[t] += is_correct ? 1 : -1;
+    }
+
+    int masked = oracle.truth[id] > 0 && oracle.holders[id] == 0;
+    oracle.truth[id] += masked ? -1 : 1;
+    oracle.pending += oracle.since[id] < 0;
+    oracle.since[id] = time();
+
+    // remember it for the live metrics
+    if (oracle.recent_count < METRICS_EVENTS)
+        oracle.recent_count++;
+    memmove(&oracle.recent[1], &oracle.recent[0], sizeof(MetricsEvent)*(oracle.recent_count - 1));
+    oracle.recent[0].target = id;
+    oracle.recent[0].timestamp = oracle.truth[id];
+    oracle.recent[0].injected = time();
+    oracle.holders[id] = oracle.agree[id] = 0;
+    for (int p=0; p<n; p++) {
+        if (p == id || states_get(states, p, id) != oracle.truth[id])
+            continue;
+        oracle.holders[id]++;
+        if (is_process_correct(processes, p))
+            oracle.agree[id]++;
+    }
+
+    for (int t=0; t<n; t++)
+        oracle_check(t);
+}
+
+/*
+ * oracle_flush advances the states baseline of every target that reached
+ * agreement during the last event. It's deferred to the end of the event
+ * since agreement is detected in the middle of states writes.
+ */
+void oracle_flush(ProcessTable *processes) {
+    for (int i=0; i<oracle.ready_count; i++) {
+        int t = oracle.ready[i];
+        oracle.queued[t] = 0;
+        if (oracle.agreed[t])
+            states_rebase(processes->states, t, oracle.truth[t]);
+    }
+    oracle.ready_count = 0;
+}
+
+/*
+ * oracle_finish reports events still waiting for agreement at the end of
+ * the simulation along with the violation count.
+ */
+void oracle_finish() {
+    if (oracle.off)
+        return;
+    int pending = 0;
+    for (int t=0; t<oracle.process_count; t++)
+        pending += oracle.since[t] >= 0;
+    printf("%4.1f: Oracle: %d violations, %d events pending agreement\n",
+           time(), oracle.violations, pending);
+}
+
+void oracle_free() {
+    free(oracle.truth);
+    free(oracle.holders);
+    free(oracle.agree);
+    free(oracle.agreed);
+    free(oracle.since);
+    free(oracle.ready);
+    free(oracle.queued);
+}
+
+/*
+ * metrics_update publishes the simulation's progress to the live metrics
+ * region, `events` being the number processed so far. O(METRICS_EVENTS).
+ */
+void metrics_update(long events, float deadline, int done) {
+    static MetricsData data;
+    static double start = -1;
+    double now = wall_seconds();
+    if (start < 0)
+        start = now;
+
+    struct smpl_counts *c = counts();
+    double elapsed = now - start - data.wall_seconds;
+    data.events_per_second = elapsed > 0 ? (events - (long) data.events) / elapsed : 0;
+    data.wall_seconds = now - start;
+    data.sim_time = time();
+    data.deadline = deadline;
+    data.events = events;
+    data.event_list = c->list_len;
+    data.pool_used = c->pool_used;
+    data.pool_max = c->pool_max;
+    data.pool_size = c->pool_size;
+    data.process_count = oracle.process_count;
+    data.faulty = oracle.process_count - oracle.correct_count;
+    data.disagreeing = oracle.disagreeing;
+    data.pending = oracle.pending;
+    data.agreements = oracle.agreements;
+    data.last_latency = oracle.last_latency;
+    data.max_latency = oracle.max_latency;
+    data.done = done;
+
+    data.event_count = oracle.recent_count;
+    for (int i=0; i<oracle.recent_count; i++) {
+        MetricsEvent *e = &data.recent[i];
+        *e = oracle.recent[i];
+        int t = e->target;
+        e->agree = oracle.agree[t];
+        e->needed = oracle.correct_count - ((liveness[LIVE_WORD(t)] & LIVE_MASK(t)) != 0);
+        if (oracle.truth[t] != e->timestamp)
+            e->state = METRICS_SUPERSEDED;
+        else
+            e->state = oracle.since[t] < 0 ? METRICS_AGREED : METRICS_PENDING;
+    }
+    metrics_publish(metrics, &data);
+}
+
+/*
+ * counters_dump prints vcube's and smpl's hot-path counters to stderr.
+ */
+void counters_dump(ProcessTable *processes) {
+    struct smpl_counts *c = counts();
+    StateStore *states = processes->states;
+    long tests = 0;
+
+    // the batch kernels work out responsibility without cis()
+    if (test_kernel == KERNEL_SCAN)
+        fprintf(stderr, "counters: cis calls %ld\n", counters.cis_calls);
+    for (int s=0; s <= MAX_CLUSTERS; s++) {
+        tests += counters.tests[s];
+        if (s > 0 && counters.tests[s])
+            fprintf(stderr, "counters: tests cluster %d %ld\n", s, counters.tests[s]);
+    }
+    fprintf(stderr, "counters: tests %ld\n", tests);
+    fprintf(stderr, "counters: update_states calls %ld (delta %ld, full %ld), entries changed %ld\n",
+            counters.merges, states->delta_merges, states->full_merges, counters.entries_changed);
+    if (states->backend == STORE_BLOCKS)
+        fprintf(stderr, "counters: states blocks %zu distinct of %zu, %ld skipped by merges as shared\n",
+                states->block_count, (size_t) states->process_count * states->row_blocks,
+                states->shared_skips);
+    for (int ev=0; ev < SMPL_EVTYPES; ev++) {
+        if (c->scheduled[ev] || c->caused[ev])
+            fprintf(stderr, "counters: event %d scheduled %ld caused %ld\n",
+                    ev, c->scheduled[ev], c->caused[ev]);
+    }
+    if (fast_forward)
+        fprintf(stderr, "counters: test rounds skipped %ld\n", quiet.skipped);
+    fprintf(stderr, "counters: enlist calls %ld, scanned %ld (max %d)\n",
+            c->enlists, c->scans, c->scan_max);
+    fprintf(stderr, "counters: pool high-water %d elements, %d reserved by facilities\n",
+            c->pool_max, c->blocks);
+}
+
+/*
+ * quiescence_start begins watching a round at the current counters.
+ */
+static void quiescence_start(StateStore *states) {
+    quiet.left = oracle.correct_count;
+    quiet.start = counters;
+    quiet.start_merges[0] = states->delta_merges;
+    quiet.start_merges[1] = states->full_merges;
+}
+
+/*
+ * quiescence_check follows the event just handled, skipping ahead once
+ * rounds are known to repeat. Times past a skip are the step-by-step ones
+ * up to the rounding of k * test_period, exact for integral periods.
+ * smpl accounts the skipped schedule and cause calls but not the event
+ * list work they would have done.
+ */
+void quiescence_check(ProcessTable *processes, int event, int token, float test_period, float deadline) {
+    StateStore *states = processes->states;
+
+    // anything but a correct process' test may change states or the test pattern
+    if (event != test || !is_process_correct(processes, token) || oracle.disagreeing) {
+        quiet.left = quiet.rounds = 0;
+        return;
+    }
+    if (quiet.left == 0) {
+        quiescence_start(states);
+        return;
+    }
+    if (--quiet.left > 0)
+        return;
+
+    Counters round;
+    round.cis_calls = counters.cis_calls - quiet.start.cis_calls;
+    for (int s=0; s <= MAX_CLUSTERS; s++)
+        round.tests[s] = counters.tests[s] - quiet.start.tests[s];
+    round.rounds = counters.rounds - quiet.start.rounds;
+    round.merges = counters.merges - quiet.start.merges;
+    round.entries_changed = counters.entries_changed - quiet.start.entries_changed;
+    long merges[2] = {states->delta_merges - quiet.start_merges[0],
+                      states->full_merges - quiet.start_merges[1]};
+
+    int repeats = quiet.rounds > 0 && round.entries_changed == 0
+                  && memcmp(&round, &quiet.round, sizeof(Counters)) == 0
+                  && memcmp(merges, quiet.round_merges, sizeof(merges)) == 0;
+    quiet.round = round;
+    memcpy(quiet.round_merges, merges, sizeof(merges));
+    quiet.rounds = repeats ? quiet.rounds + 1 : 1;
+
+    // a crashed process whose test is still pending would miss it on the way
+    for (int p=0; repeats && p < processes->states->process_count; p++)
+        repeats = is_process_correct(processes, p) || processes->has_missed_test[p];
+
+    long k = repeats ? advance(test, test_period, deadline) : 0;
+    if (k > 0) {
+        counters.cis_calls += k * round.cis_calls;
+        for (int s=0; s <= MAX_CLUSTERS; s++)
+            counters.tests[s] += k * round.tests[s];
+        counters.rounds += k * round.rounds;
+        counters.merges += k * round.merges;
+        states->delta_merges += k * merges[0];
+        states->full_merges += k * merges[1];
+        quiet.skipped += k;
+        printf("%4.1f: Diagnosis quiescent, skipped %ld test rounds\n", time(), k);
+    }
+    quiescence_start(states);
+}
+
+void termination_init(Args *args) {
+    termination.converge = args->converge;
+    termination.window = args->steady_window > 0 ? args->steady_window : 0;
+    termination.window_end = termination.window;
+    termination.window_agreements = 0;
+    termination.mean = -1;
+    termination.steady = 0;
+}
+
+/*
+ * termination_check tells whether the run may stop after the event just
+ * handled, printing why. smpl counts the events of the batch being
+ * handled as caused already: those still to come are left_events.
+ * O(1) per event, the rest of the batch aside.
+ */
+int termination_check(const int *left_events, int left_count) {
+    if (termination.converge && oracle.disagreeing == 0) {
+        struct smpl_counts *c = counts();
+        long left = 0;
+        for (int ev=fault; ev <= refill; ev++)
+            left += c->scheduled[ev] - c->caused[ev];
+        left += c->scheduled[branch] - c->caused[branch];
+        for (int i=0; left == 0 && i<left_count; i++)
+            left += (left_events[i] >= fault && left_events[i] <= refill) || left_events[i] == branch;
+        if (left == 0) {
+            printf("%4.1f: Diagnosis converged, nothing left to inject: stopping\n", time());
+            return 1;
+        }
+    }
+
+    if (termination.window == 0 || time() < termination.window_end)
+        return 0;
+    while (termination.window_end <= time())
+        termination.window_end += termination.window;
+
+    double mean = oracle.agreements ? oracle.latency_sum / oracle.agreements : 0;
+    int added = oracle.agreements > termination.window_agreements;
+    if (added && termination.mean > 0 && fabs(mean - termination.mean) <= STEADY_TOLERANCE * termination.mean)
+        termination.steady++;
+    else
+        termination.steady = 0;
+    termination.mean = added ? mean : -1;
+    termination.window_agreements = oracle.agreements;
+    if (termination.steady < STEADY_WINDOWS)
+        return 0;
+    printf("%4.1f: Diagnosis latency steady at %.2f: stopping\n", time(), mean);
+    return 1;
+}
+
+/*
+ * partition_start splits this run into `partitions` OS processes over
+ * Unix domain sockets. Each returns from it as its own partition, the
+ * caller being partition 0. Output is line buffered so that their lines
+ * interleave whole.
+ */
+void partition_start(int partitions) {
+    fflush(stdout);
+    partition.transport = transport_unix_spawn(partitions);
+    if (partition.transport == NULL) {
+        printf("could not start %d partitions\n", partitions);
+        exit(1);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+// partition_queue has `tester` merge `testee`'s vector at the next exchange
+void partition_queue(int tester, int testee) {
+    if (partition.merge_count == partition.merge_cap) {
+        partition.merge_cap = partition.merge_cap ? partition.merge_cap * 2 : 64;
+        partition.merges = (int*) realloc(partition.merges, sizeof(int)*2*partition.merge_cap);
+        if (partition.merges == NULL) {
+            printf("could not queue merges\n");
+            exit(1);
+        }
+    }
+    partition.merges[2*partition.merge_count] = tester;
+    partition.merges[2*partition.merge_count + 1] = testee;
+    partition.merge_count++;
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    const int *x = (const int*) a, *y = (const int*) b;
+    return x[0] != y[0] ? x[0] - y[0] : x[1] - y[1];
+}
+
+static void exchange_or_die(void **out, size_t *out_len, void **in, size_t *in_len) {
+    if (transport_exchange(partition.transport, out, out_len, in, in_len) != 0) {
+        printf("partition %d lost its peers\n", partition.transport->rank);
+        exit(1);
+    }
+}
+
+/*
+ * partition_exchange carries out the merges queued since the last
+ * exchange. Partitions first send each other the ids of the testees they
+ * need, sorted, then the vectors asked of them in the same order, and
+ * every tester whose vector changed prints it. O(n) per vector sent and
+ * per merge.
+ */
+void partition_exchange(ProcessTable *processes, int process_count) {
+    StateStore *states = processes->states;
+    int ranks = partition.transport->ranks;
+    void *out[ranks], *in[ranks], *rows[ranks];
+    size_t out_len[ranks], in_len[ranks], rows_len[ranks];
+    partition.exchanges++;
+
+    // testees needed, sorted and unique, so each partition's are a run
+    qsort(partition.merges, partition.merge_count, 2*sizeof(int), compare_pairs);
+    int *ids = (int*) malloc(sizeof(int)*(partition.merge_count + 1));
+    if (ids == NULL) {
+        printf("could not exchange vectors\n");
+        exit(1);
+    }
+    for (int i=0; i<partition.merge_count; i++)
+        ids[i] = partition.merges[2*i + 1];
+    qsort(ids, partition.merge_count, sizeof(int), compare_ids);
+    int unique = 0;
+    for (int i=0; i<partition.merge_count; i++) {
+        if (unique == 0 || ids[unique-1] != ids[i])
+            ids[unique++] = ids[i];
+    }
+    int run[ranks + 1]; // ids of partition q are ids[run[q] .. run[q+1]-1]
+    for (int q=0, i=0; q <= ranks; q++) {
+        while (i < unique && ids[i] / partition.count < q)
+            i++;
+        run[q] = i;
+    }
+    for (int q=0; q<ranks; q++) {
+        out[q] = &ids[run[q]];
+        out_len[q] = sizeof(int)*(run[q+1] - run[q]);
+    }
+    exchange_or_die(out, out_len, in, in_len);
+
+    for (int q=0; q<ranks; q++) {
+        int asked = (int) (in_len[q] / sizeof(int));
+        int *wanted = (int*) in[q];
+        out[q] = malloc(sizeof(int)*process_count*asked + 1);
+        out_len[q] = sizeof(int)*process_count*asked;
+        if (out[q] == NULL) {
+            printf("could not exchange vectors\n");
+            exit(1);
+        }
+        for (int k=0; k<asked; k++) {
+            if (!is_local(wanted[k])) {
+                printf("partition %d asked for process %d\n", q, wanted[k]);
+                exit(1);
+            }
+            states_row(states, wanted[k], (int*) out[q] + (size_t) k * process_count);
+        }
+        free(in[q]);
+    }
+    exchange_or_die(out, out_len, rows, rows_len);
+
+    for (int i=0, changed=0; i<partition.merge_count; i++) {
+        int tester = partition.merges[2*i];
+        int testee = partition.merges[2*i + 1];
+        int *found = (int*) bsearch(&testee, ids, unique, sizeof(int), compare_ids);
+        int q = testee / partition.count;
+        const int *row = (const int*) rows[q] + (size_t) (found - &ids[run[q]]) * process_count;
+
+        output.tester = tester;
+        int merged = states_merge_row(states, tester, row);
+        counters.merges++;
+        counters.entries_changed += merged;
+        partition.remote_merges++;
+        PROBE3(vcube, merge, tester, testee, merged);
+        changed += merged;
+        // a tester's merges are in a row
+        if (i+1 == partition.merge_count || partition.merges[2*i + 2] != tester) {
+            if (changed)
+                print_states(processes, tester, process_count);
+            output.tester = -1;
+            changed = 0;
+        }
+    }
+
+    for (int q=0; q<ranks; q++) {
+        free(out[q]);
+        free(rows[q]);
+    }
+    free(ids);
+    partition.merge_count = 0;
+}
+
+/*
+ * partition_finish checks diagnosis over the whole system, as the oracle
+ * can't: each partition counts its correct processes that hold every
+ * other process' state right, and partition 0 prints the totals along
+ * with what the exchanges cost. Merges still queued are dropped.
+ */
+void partition_finish(ProcessTable *processes, int process_count) {
+    Transport *transport = partition.transport;
+    int ranks = transport->ranks;
+    // right, correct, messages, bytes
+    long totals[4] = {0, 0, 0, 0};
+    for (int p=partition.first; p < partition.first + partition.count; p++) {
+        if (!is_process_correct(processes, p))
+            continue;
+        int right = 1;
+        for (int t=0; t<process_count && right; t++) {
+            int v = states_get(processes->states, p, t);
+            right = t == p || (v >= 0 && IS_CORRECT(v) == is_process_correct(processes, t));
+        }
+        totals[0] += right;
+        totals[1]++;
+    }
+    totals[2] = transport->messages;
+    totals[3] = transport->bytes;
+
+    void *out[ranks], *in[ranks];
+    size_t out_len[ranks], in_len[ranks];
+    for (int q=0; q<ranks; q++) {
+        out[q] = totals;
+        out_len[q] = sizeof(totals);
+    }
+    exchange_or_die(out, out_len, in, in_len);
+    for (int q=0; q<ranks; q++) {
+        for (int k=0; in[q] && transport->rank == 0 && k<4; k++)
+            totals[k] += ((long*) in[q])[k];
+        free(in[q]);
+    }
+
+    if (transport->rank == 0)
+        printf("%4.1f: Partitions: %ld of %ld correct processes diagnose every process right; "
+               "%ld exchanges, %ld messages, %ld bytes\n", time(), totals[0], totals[1],
+               partition.exchanges, totals[2], totals[3]);
+}
+
+/*
+ * branching_init reads the variants and schedules the branch point, if
+ * it's a set time.
+ */
+void branching_init(Args *args) {
+    char error[128];
+    branching.variants = variants_read(args->variants_path, &branching.count, error, sizeof(error));
+    if (branching.variants == NULL) {
+        printf("variants file %s %s\n", args->variants_path, error);
+        exit(1);
+    }
+    for (int v=0; v<branching.count; v++) {
+        for (int i=0; i<branching.variants[v].count; i++) {
+            if (branching.variants[v].records[i].process >= args->process_count) {
+                printf("variant %s has a record for process %d, past the last one\n",
+                       branching.variants[v].name, branching.variants[v].records[i].process);
+                exit(1);
+            }
+        }
+    }
+    branching.jobs = args->jobs;
+    branching.at = args->branch_at;
+    branching.ahead = 1;
+    if (branching.at >= 0)
+        schedule(branch, branching.at, 0);
+}
+
+/*
+ * branch_off forks a child per variant at the branch point. A child
+ * schedules its variant's faults and recoveries, clears what its result
+ * counts and returns 0 for its run to go on, its output discarded as
+ * with -c. The parent prints what every variant reported and returns 1
+ * for its run to stop there.
+ */
+int branch_off() {
+    branching.ahead = 0;
+    printf("%4.1f: Branching %d variants\n", time(), branching.count);
+    fflush(stdout);
+    fflush(stderr);
+
+    VariantResult *results = (VariantResult*) calloc(branching.count, sizeof(VariantResult));
+    if (results == NULL) {
+        printf("could not branch\n");
+        exit(1);
+    }
+    double start = wall_seconds();
+    int v = branch_fork(branching.count, branching.jobs, sizeof(VariantResult), results);
+    if (v >= 0) {
+        free(results);
+        if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL)
+            exit(1);
+        branching.variant = v;
+        oracle.agreements = 0;
+        oracle.latency_sum = oracle.last_latency = oracle.max_latency = 0;
+        memset(&counters, 0, sizeof(counters));
+        memset(&quiet, 0, sizeof(quiet));
+
+        Variant *variant = &branching.variants[v];
+        for (int i=0; i<variant->count; i++) {
+            FaultRecord *rec = &variant->records[i];
+            schedule(rec->kind == FAULTLOG_FAULT ? fault : recovery, rec->time, rec->process);
+        }
+        return 0;
+    }
+
+    printf("%4.1f: %d variants done in %.2f s\n", time(), branching.count, wall_seconds() - start);
+    printf("%-16s %8s %10s %12s %12s %8s %10s %12s %10s %8s\n", "variant", "records",
+           "agreements", "mean latency", "max latency", "pending", "violations", "tests",
+           "disagree", "end");
+    for (int i=0; i<branching.count; i++) {
+        VariantResult *r = &results[i];
+        if (!r->done) {
+            printf("%-16s %8d failed\n", branching.variants[i].name, branching.variants[i].count);
+            continue;
+        }
+        printf("%-16s %8d %10ld %12.2f %12.2f %8d %10d %12ld %10d %8.1f\n",
+               branching.variants[i].name, branching.variants[i].count, r->agreements,
+               r->mean_latency, r->max_latency, r->pending, r->violations, r->tests,
+               r->disagreeing, r->end);
+    }
+    free(results);
+    return 1;
+}
+
+// branch_result reports how the variant this child ran went and ends it
+void branch_result() {
+    VariantResult r;
+    memset(&r, 0, sizeof(r));
+    r.done = 1;
+    r.pending = oracle.pending;
+    r.violations = oracle.violations;
+    r.disagreeing = oracle.disagreeing;
+    r.agreements = oracle.agreements;
+    for (int s=0; s <= MAX_CLUSTERS; s++)
+        r.tests += counters.tests[s];
+    r.mean_latency = oracle.agreements ? oracle.latency_sum / oracle.agreements : 0;
+    r.max_latency = oracle.max_latency;
+    r.end = time();
+    branch_report(&r, sizeof(r));
 }
 
 /*
@@ -249,7 +1838,7 @@ int is_process_correct(ProcessFacility *processes, int id) {
  * it receives the tester's id, the list of processes and the process_count.
  * vcube_test sequentially tests all clusters for the given process.
  */
-void vcube_test(int id, ProcessFacility *processes, int process_count) {
+void vcube_test(int id, ProcessTable *processes, int process_count) {
     printf("%4.1f: Test round for process %d\n", time(), id);
     int cluster_count = (int) ceill(log2(process_count));
 
@@ -259,36 +1848,120 @@ void vcube_test(int id, ProcessFacility *processes, int process_count) {
     }
 }
 
+/*
+ * test_target tests `target` on behalf of `id` in cluster `s`.
+ * Return the number of states entries the tester learned from it.
+ */
+static int test_target(int id, int target, int s, ProcessTable *processes) {
+    StateStore *states = processes->states;
+    int current = states_get(states, id, target);
+
+    int is_correct = is_process_correct(processes, target);
+    counters.tests[s < MAX_CLUSTERS ? s : MAX_CLUSTERS]++;
+    PROBE3(vcube, test, id, target, is_correct);
+    states_set(states, id, target, next_timestamp(current, is_correct));
+    if (is_correct) {
+        printf("%4.1f: %d -> %d: CORRECT\n", time(), id, target);
+        if (!is_local(target)) {
+            partition_queue(id, target);
+            return 0;
+        }
+        return algorithm->merge(states, id, target);
+    }
+    printf("%4.1f: %d -> %d: FAULTY\n", time(), id, target);
+    return 0;
+}
+
 /*
  * test_cluster executes the associated test for cluster `s` and process `id`.
  * For all correct processes tested, test_cluster updates the tester's state vector
  * by fetch missing events from the testee's event vector.
+ *
+ * Cluster s of `id` is the half block id ^ 2^(s-1) ^ v, v < 2^(s-1), and
+ * cis(target, s) lists target ^ 2^(s-1) ^ k for k = 0, 1, ... So with
+ * m = v ^ (id's offset in its own half), id comes m-th in the cis of
+ * target and is responsible for it when everything listed before it is
+ * faulty. The targets listed before id are, for every bit j set in m, a
+ * whole cluster j+1 of id: responsible_clusters finds which of those are
+ * all faulty and id tests the targets whose m only has those bits set.
+ * Tests go in target order as a merge may change what id knows about its
+ * own half, in which case the set is worked out again for the rest.
  */
-void test_cluster(int id, int s, ProcessFacility *processes, int process_count) {
-    for (int target=0; target < process_count; target++) {
-        if (is_first_correct_process_in_cis(id, target, s, processes[id].states)) {
-            int current = processes[id].states[target];
-
-            int is_correct = is_process_correct(processes, target);
-            processes[id].states[target] = next_timestamp(current, is_correct);
-            if (is_correct) {
-                printf("%4.1f: %d -> %d: CORRECT\n", time(), id, target);
-                update_states(process_count, id, processes[id].states, processes[target].states);
-            }
-            else {
-                printf("%4.1f: %d -> %d: FAULTY\n", time(), id, target);
-            }
+void test_cluster(int id, int s, ProcessTable *processes, int process_count) {
+    StateStore *states = processes->states;
+    if (test_kernel == KERNEL_SCAN) {
+        for (int target=0; target < process_count; target++) {
+            if (is_first_correct_process_in_cis(id, target, s, states))
+                test_target(id, target, s, processes);
         }
+        return;
     }
 
+    int half = 1 << (s-1);
+    int low = id & (half-1);
+    int first = (id ^ half) & ~(half-1);
+    int responsible = responsible_clusters(states, id, s);
+    for (int v=0; v < half && first + v < process_count; v++) {
+        if (((v ^ low) & ~responsible) != 0)
+            continue;
+        if (test_target(id, first + v, s, processes) > 0)
+            responsible = responsible_clusters(states, id, s);
+    }
+}
+
+/*
+ * ring_test is Adaptive-DSD's test round: `id` tests its successors on
+ * the ring until it finds a correct one, and learns about everybody else
+ * from it. That's a single test per process while nobody is faulty, but
+ * news only travel one hop back per round, against a cluster per round
+ * for vcube.
+ */
+void ring_test(int id, ProcessTable *processes, int process_count) {
+    printf("%4.1f: Test round for process %d\n", time(), id);
+    for (int k=1; k < process_count; k++) {
+        int target = (id + k) % process_count;
+        test_target(id, target, 0, processes);
+        if (IS_CORRECT(states_get(processes->states, id, target)))
+            break;
+    }
+}
+
+/*
+ * responsible_clusters returns a mask with bit j set when `tester` holds
+ * every process of its cluster j+1 as faulty, for j < s-1, reading the
+ * parity of the tester's states over its half of cluster s in one pass.
+ * Processes past the last one count as faulty.
+ */
+int responsible_clusters(StateStore *states, int tester, int s) {
+    int half = 1 << (s-1);
+    int low = tester & (half-1);
+    states_odd_mask(states, tester, tester & ~(half-1), half, odd_mask);
+
+    int responsible = 0;
+    for (int j=0; j < s-1; j++) {
+        int size = 1 << j;
+        int start = (low ^ size) & ~(size-1);
+        int faulty = 1;
+        if (size < 64) {
+            uint64_t all = (((uint64_t) 1) << size) - 1;
+            faulty = ((odd_mask[start >> 6] >> (start & 63)) & all) == all;
+        }
+        else {
+            for (int w = start >> 6; faulty && w < (start + size) >> 6; w++)
+                faulty = odd_mask[w] == ~(uint64_t) 0;
+        }
+        responsible |= faulty << j;
+    }
+    return responsible;
 }
 
 /*
  * return wheter process `tester` is the first correct process for cis(target, s).
  * The tester's states vector is checked in in order to determine which is the first correct process.
  */
-int is_first_correct_process_in_cis(int tester, int target, int s, int *states) {
+int is_first_correct_process_in_cis(int tester, int target, int s, StateStore *states) {
     node_set *nodes = cis(target, s);
+    counters.cis_calls++;
     int result = 0;
     for (int i=0; i < nodes->size; i++) {
         int pid = nodes->nodes[i];
@@ -297,7 +1970,11 @@ int is_first_correct_process_in_cis(int tester, int target, int s, int *states)
             result = 1;
             break;
         }
-        else if (IS_FAULTY(states[pid])) {
+        else if (pid >= states->process_count) {
+            // ids past the last process are absent from the system
+            continue;
+        }
+        else if (IS_FAULTY(states_get(states, tester, pid))) {
             // if process is faulty we keep going
             // as we must determine whether tester is the
             // first *correct* process in the cis(target, s)
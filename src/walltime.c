@@ -0,0 +1,14 @@
+/* Relogio de parede
+ * Funcionalidade: tempo monotonico em segundos para medicoes, fora dos
+ * arquivos que incluem smpl.h (cujo time() conflita com o de <time.h>).
+ */
+
+#include <time.h>
+
+#include "walltime.h"
+
+double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
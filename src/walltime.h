@@ -0,0 +1,12 @@
+/* Relogio de parede
+ * Funcionalidade: tempo monotonico em segundos para medicoes, fora dos
+ * arquivos que incluem smpl.h (cujo time() conflita com o de <time.h>).
+ */
+
+#ifndef WALLTIME_H
+#define WALLTIME_H
+
+// seconds elapsed on a monotonic clock since an arbitrary origin
+double wall_seconds(void);
+
+#endif